@@ -17,13 +17,140 @@
     ///////////////////////////////////
 
 
-    typedef struct v8_instance_t    v8_instance_t;
-    typedef void*                   v8_value_t;
-    typedef void*                   v8_template_t;
-    typedef const void*             v8_callback_info_t;
+    typedef struct v8_instance_t        v8_instance_t;
+    typedef struct v8_isolate_t         v8_isolate_t;
+    typedef struct v8_context_t         v8_context_t;
+    typedef struct v8_context_pool_t    v8_context_pool_t;
+    typedef struct v8_scheduler_t       v8_scheduler_t;
+    typedef struct v8_script_t          v8_script_t;
+    typedef struct v8_stream_t          v8_stream_t;
+    typedef struct v8_wasm_stream_t     v8_wasm_stream_t;
+    typedef struct v8_scheduler_entry_t v8_scheduler_entry_t;
+    typedef struct v8_isolate_pool_t    v8_isolate_pool_t;
+    typedef struct v8_key_t             v8_key_t;
+    typedef void*                       v8_value_t;
+    typedef void*                       v8_template_t;
+    typedef const void*                 v8_callback_info_t;
+
+    typedef enum
+    {
+        V8_INT8_ARRAY,
+        V8_UINT8_ARRAY,
+        V8_UINT8_CLAMPED_ARRAY,
+        V8_INT16_ARRAY,
+        V8_UINT16_ARRAY,
+        V8_INT32_ARRAY,
+        V8_UINT32_ARRAY,
+        V8_FLOAT32_ARRAY,
+        V8_FLOAT64_ARRAY,
+        V8_BIGINT64_ARRAY,
+        V8_BIGUINT64_ARRAY,
+        V8_DATA_VIEW,
+    } v8_typed_array_t;
 
     typedef void (*v8_start_cb_t)(v8_value_t global, void *data);
     typedef void (*v8_func_cb_t)(v8_callback_info_t cb_info, int argc, void *data);
+    typedef void (*v8_unlocked_cb_t)(void *data);
+
+    // Called once V8 releases external memory, possibly from another thread.
+    typedef void (*v8_free_cb_t)(void *ptr, size_t length, void *hint);
+    typedef void (*v8_task_cb_t)(v8_isolate_t *isolate, void *data);
+
+    // Writes the resolved name of `specifier` in `name` and returns its source allocated with malloc, or NULL.
+    // The referrer is NULL for modules loaded by the host. The source of an already loaded name is ignored.
+    // Names longer than `size` - 1 bytes are truncated, leaving `name` empty fails the import.
+    typedef char *(*v8_module_resolve_cb_t)(const char *specifier, const char *referrer, char *name, size_t size, void *data);
+
+    typedef enum
+    {
+        V8_COMPILE_DEFAULT  = 0,
+        V8_COMPILE_EAGER    = 1 << 0,   // Compile every function upfront instead of on first call.
+    } v8_compile_flags_t;
+
+    typedef struct
+    {
+        v8_value_t      func;
+        v8_value_t      *args;
+        size_t          argc;
+    } v8_warmup_call_t;
+
+    typedef struct
+    {
+        uint64_t        hits;
+        uint64_t        misses;
+        uint64_t        rejects;        // Entries refused by V8 and regenerated.
+    } v8_code_cache_stats_t;
+
+    typedef struct
+    {
+        int             cpu;            // Core the shard is pinned to, -1 if not pinned.
+        size_t          isolates;
+        size_t          queue_depth;    // Isolates waiting to run.
+        uint64_t        tasks_run;
+        uint64_t        busy_time;      // Microseconds spent running tasks.
+        uint64_t        steals;         // Isolates taken from busier shards.
+        double          utilization;    // Busy time over the lifetime of the scheduler.
+    } v8_shard_stats_t;
+
+    typedef enum
+    {
+        V8_HEAP_LIMIT_DEFAULT,      // V8 aborts the process when running out of memory.
+        V8_HEAP_LIMIT_GROW,         // Raise the limit, it is never lowered again.
+        V8_HEAP_LIMIT_TERMINATE,    // Terminate the running script, the limit is restored once the heap shrinks.
+        V8_HEAP_LIMIT_EVICT,        // Let the host release references, the limit is restored once the heap shrinks.
+    } v8_heap_limit_policy_t;
+
+    // Runs inside the garbage collector: it must neither run JavaScript nor call into the binding, nothing may be allocated.
+    typedef void (*v8_heap_limit_cb_t)(v8_isolate_t *isolate, v8_heap_limit_policy_t policy, size_t current_limit, size_t initial_limit, void *data);
+
+    typedef struct
+    {
+        size_t                  initial_old_generation_size;    // Bytes, 0 keeps the V8 default.
+        size_t                  max_old_generation_size;
+        size_t                  initial_young_generation_size;
+        size_t                  max_young_generation_size;
+        size_t                  stack_size;                     // Bytes of native stack usable from the entering thread.
+        v8_heap_limit_policy_t  heap_limit_policy;
+        size_t                  heap_limit_growth;              // Bytes added to the limit when reached, 0 for a quarter of the initial limit.
+        v8_heap_limit_cb_t      heap_limit_cb;                  // Reports the heap limit being reached, needs a policy other than default.
+        void                    *heap_limit_data;
+        size_t                  script_cache_count;             // Scripts run by v8_script_run kept compiled, 0 disables the cache.
+        size_t                  script_cache_bytes;             // Source bytes of the cached scripts, 0 for no bound.
+    } v8_isolate_params_t;
+
+    typedef struct
+    {
+        size_t                  count;
+        size_t                  bytes;
+        uint64_t                hits;
+        uint64_t                misses;
+        uint64_t                evictions;
+    } v8_script_cache_stats_t;
+
+    typedef struct
+    {
+        const char      *data;
+        int             size;
+    } v8_snapshot_t;
+
+    typedef struct
+    {
+        const char      *name;
+        v8_func_cb_t    cb;         // Called with the data given to v8_isolate_start / v8_isolate_run / v8_isolate_set_data.
+    } v8_snapshot_func_t;
+
+    typedef struct
+    {
+        int                         thread_pool_size;           // Platform worker threads, 0 for one per core.
+        int                         idle_task_support;          // Idle tasks are run by v8_isolate_pump.
+        int                         in_process_stack_dumping;
+        const char                  *startup_data_path;         // V8 snapshot_blob.bin to map read-only, instead of reading it at init.
+        const char                  *icu_data_path;             // icudtl.dat to map read-only, needs a build with ICU_INCLUDE.
+        const char                  *code_cache_path;           // Existing directory where compiled scripts are cached, read once per script and isolate.
+        v8_snapshot_t               snapshot;                   // Optional startup snapshot.
+        const v8_snapshot_func_t    *snapshot_funcs;
+        size_t                      snapshot_func_count;
+    } v8_config_t;
 
 
     ///////////////////////////////////
@@ -33,30 +160,63 @@
 
     // Init
     v8_instance_t *v8_initialize(const char *path);
+    v8_instance_t *v8_initialize_snapshot(const char *path, v8_snapshot_t snapshot, const v8_snapshot_func_t *funcs, size_t count);
+    v8_instance_t *v8_initialize_config(const char *path, const v8_config_t *config);
     void v8_shutdown(v8_instance_t *instance);
 
     // Values
     v8_value_t v8_create_int32(int32_t value);
     v8_value_t v8_create_uint32(uint32_t value);
     v8_value_t v8_create_int64(int64_t value);
+    v8_value_t v8_create_bigint64(int64_t value);
+    v8_value_t v8_create_ubigint64(uint64_t value);
     v8_value_t v8_create_double(double value);
     v8_value_t v8_create_array(size_t length);
-    v8_value_t v8_create_uint8_array(size_t size);
-    v8_value_t v8_create_uint16_array(size_t size);
-    v8_value_t v8_create_uint32_array(size_t size);
+    v8_value_t v8_create_array_from_values(v8_value_t *values, size_t count);
+    v8_value_t v8_create_array_from_doubles(const double *values, size_t count);
+    v8_value_t v8_create_array_from_int32s(const int32_t *values, size_t count);
+    v8_value_t v8_create_array_from_utf8_strings(const char **values, size_t count);
+    v8_value_t v8_create_uint8_array(size_t length);
+    v8_value_t v8_create_uint16_array(size_t length);
+    v8_value_t v8_create_uint32_array(size_t length);
+    v8_value_t v8_create_typed_array(v8_typed_array_t type, size_t length);
+    v8_value_t v8_create_bigint64_array(const int64_t *values, size_t count);
+    v8_value_t v8_create_biguint64_array(const uint64_t *values, size_t count);
+    v8_value_t v8_create_typed_array_external(v8_typed_array_t type, void *ptr, size_t length, v8_free_cb_t free_cb, void *hint);
     v8_value_t v8_create_string_utf8(const char* str);
     v8_value_t v8_create_string_utf16(const char16_t* str);
+    // External strings call `free_cb` once collected, on NULL the characters are still owned by the caller.
+    v8_value_t v8_create_string_external_latin1(const char *str, size_t length, v8_free_cb_t free_cb, void *hint);
+    v8_value_t v8_create_string_external_utf16(const char16_t *str, size_t length, v8_free_cb_t free_cb, void *hint);
+    int v8_string_externalize(v8_value_t string);
     v8_value_t v8_create_object(void);
     v8_template_t v8_create_function_template(void);
     v8_value_t v8_create_ref(v8_value_t value);
 
+    // Keys
+    // Internalized property name cached by the current isolate, valid until the isolate is disposed.
+    v8_key_t *v8_intern_key(const char *name, size_t length);
+
     // Getters
     v8_value_t v8_get_ref_value(v8_value_t ref);
+    v8_value_t v8_get_obj_key(v8_value_t object, v8_key_t *key);
+    v8_value_t v8_get_array_element(v8_value_t array, uint32_t index);
+    // BigInts convert exactly, numbers are truncated and saturated, `lossless` (optional) is cleared when bits were lost.
+    int64_t v8_get_int64(v8_value_t value, int *lossless);
+    uint64_t v8_get_uint64(v8_value_t value, int *lossless);
     size_t v8_get_utf8(v8_value_t value, char* buf, size_t len);
+    void *v8_get_typed_array_data(v8_value_t value, size_t *byte_length);
     void v8_get_callback_args(v8_callback_info_t cb_info, v8_value_t* args, int argc);
 
+    // Typed arrays
+    // Copy `count` elements from / to element `offset`, clamped to the array, returns the number of bytes copied.
+    size_t v8_typed_array_write(v8_value_t array, size_t offset, const void *src, size_t count);
+    size_t v8_typed_array_read(v8_value_t array, size_t offset, void *dst, size_t count);
+
     // Setters
     void v8_set_obj_var(v8_value_t object, const char *key, v8_value_t value);
+    void v8_set_obj_key(v8_value_t object, v8_key_t *key, v8_value_t value);
+    void v8_set_array_element(v8_value_t array, uint32_t index, v8_value_t value);
     void v8_set_template_var(v8_template_t object, const char key, v8_value_t value);
 
     // Functions
@@ -65,7 +225,117 @@
 
     // Context
     void v8_isolate_start(v8_start_cb_t start_cb, void *data);
+    void v8_isolate_run(v8_isolate_t *isolate, v8_start_cb_t start_cb, void *data);
     v8_value_t v8_script_run(const char *source_code);
+    v8_value_t v8_script_run_external(const char *path);
+
+    // Scripts
+    // Compiled once in the current isolate, run in any of its contexts, NULL for the current one.
+    // Code cache entries are kept per compile flags.
+    v8_script_t *v8_script_compile(const char *source_code);
+    v8_script_t *v8_script_compile_flags(const char *source_code, int flags);
+    v8_value_t v8_script_exec(v8_script_t *script, v8_context_t *context);
+    void v8_script_dispose(v8_script_t *script);
+    void v8_script_update_code_cache(v8_script_t *script);
+    void v8_code_cache_stats(v8_code_cache_stats_t *stats);
+    void v8_script_cache_stats(v8_isolate_t *isolate, v8_script_cache_stats_t *stats);
+
+    // Warm-up
+    // Calls each recorded call `iterations` times, then v8_script_update_code_cache persists the compiled functions.
+    void v8_warmup(const v8_warmup_call_t *calls, size_t count, size_t iterations);
+
+    // Streaming
+    // The source is parsed on a worker thread while it is written, UTF-8 encoded.
+    // Start and finish on the isolate thread, write from a single thread of any kind.
+    v8_stream_t *v8_script_stream_start(const char *name);
+    void v8_script_stream_write(v8_stream_t *stream, const char *data, size_t length);
+    v8_script_t *v8_script_stream_finish(v8_stream_t *stream);
+    v8_script_t *v8_script_compile_file(const char *path);
+
+    // Compiles files in parallel on the platform workers, `scripts[i]` is NULL when `paths[i]` fails.
+    // Returns the number of compiled scripts, run them in order with v8_script_exec.
+    size_t v8_script_compile_files(const char **paths, size_t count, v8_script_t **scripts);
+
+    // Modules
+    // Each resolved name is compiled and evaluated once per context, and released with the context.
+    // Returns the module namespace, or NULL on error.
+    void v8_module_set_resolver(v8_module_resolve_cb_t cb, void *data);
+    v8_value_t v8_module_load(const char *specifier);
+
+    // WebAssembly
+    // Compiled modules are cached by wire bytes, or by the given key when streaming, when the code cache is enabled.
+    // Returns a WebAssembly.Module, or NULL on error. Instantiation returns the exports of the instance.
+    // Called from a host function, compilation cannot complete under JavaScript frames, a pending Promise is returned.
+    v8_value_t v8_wasm_compile(const uint8_t *bytes, size_t length);
+    v8_wasm_stream_t *v8_wasm_stream_start(const char *cache_key, size_t length);
+    void v8_wasm_stream_write(v8_wasm_stream_t *stream, const uint8_t *bytes, size_t length);
+    v8_value_t v8_wasm_stream_finish(v8_wasm_stream_t *stream);
+    v8_value_t v8_wasm_instantiate(v8_value_t module, v8_value_t imports);
+
+    // Isolate lifecycle
+    // Enter and exit calls must be balanced, in reverse order, on the same thread.
+    // Entering locks the isolate, any thread may enter it once the previous one exited.
+    // Data set with v8_isolate_set_data is given to snapshot functions, v8_isolate_run overrides it while running.
+    // Creation returns NULL when a heap limit callback is given with the default heap limit policy.
+    v8_isolate_t *v8_isolate_new(void);
+    v8_isolate_t *v8_isolate_new_params(const v8_isolate_params_t *params);
+    void v8_isolate_enter(v8_isolate_t *isolate);
+    void v8_isolate_set_data(v8_isolate_t *isolate, void *data);
+    void v8_isolate_exit(v8_isolate_t *isolate);
+    void v8_isolate_unlocked(v8_isolate_t *isolate, v8_unlocked_cb_t cb, void *data);
+    int v8_isolate_is_locked(v8_isolate_t *isolate);
+
+    // Message loop
+    // Runs foreground tasks posted by V8 for at most `budget` microseconds, the isolate must be entered.
+    // A non zero pump budget pumps automatically after each v8_script_run / v8_call_function, unless called from a host function.
+    size_t v8_isolate_pump(v8_isolate_t *isolate, uint64_t budget);
+    void v8_isolate_set_pump_budget(v8_isolate_t *isolate, uint64_t budget);
+    void v8_isolate_dispose(v8_isolate_t *isolate);
+    v8_context_t *v8_isolate_context(v8_isolate_t *isolate);
+
+    // Context lifecycle
+    // The isolate of the context must be entered. Disposing the default context of an isolate does nothing.
+    v8_context_t *v8_context_new(void);
+    v8_value_t v8_context_enter(v8_context_t *context);
+    void v8_context_exit(v8_context_t *context);
+    void v8_context_dispose(v8_context_t *context);
+
+    // Context pool
+    // Keeps `size` fresh contexts of the current isolate, used contexts are disposed on release, never recycled:
+    // V8 cannot reset a context, and scripts may have changed its globals and builtins.
+    // Refill out of the request path, e.g. when the host loop is idle. The isolate of the pool must be entered.
+    v8_context_pool_t *v8_context_pool_new(size_t size);
+    v8_context_t *v8_context_pool_acquire(v8_context_pool_t *pool);
+    void v8_context_pool_release(v8_context_pool_t *pool, v8_context_t *context);
+    void v8_context_pool_refill(v8_context_pool_t *pool);
+    void v8_context_pool_dispose(v8_context_pool_t *pool);
+
+    // Isolate pool
+    // Keeps at least `min_size` isolates with a ready context, up to `max_size` isolates in total, NULL when both are 0.
+    // Acquired isolates must be released to the pool before disposing it.
+    // Released isolates get a fresh context, their data, module resolver, pump budget and heap limit are reset.
+    v8_isolate_pool_t *v8_isolate_pool_new(size_t min_size, size_t max_size);
+    v8_isolate_pool_t *v8_isolate_pool_new_params(size_t min_size, size_t max_size, const v8_isolate_params_t *params);
+    v8_isolate_t *v8_isolate_pool_acquire(v8_isolate_pool_t *pool);
+    void v8_isolate_pool_release(v8_isolate_pool_t *pool, v8_isolate_t *isolate);
+    void v8_isolate_pool_dispose(v8_isolate_pool_t *pool);
+
+    // Scheduler
+    // Runs posted tasks with the isolate and its default context entered, on one pinned thread per shard.
+    // Idle shards take queued isolates from the busiest shard.
+    // A task may remove its own entry, the remaining tasks are dropped and the removal completes once it returns.
+    v8_scheduler_t *v8_scheduler_new(size_t shards);
+    v8_scheduler_entry_t *v8_scheduler_add(v8_scheduler_t *scheduler, v8_isolate_t *isolate);
+    void v8_scheduler_post(v8_scheduler_t *scheduler, v8_scheduler_entry_t *entry, v8_task_cb_t cb, void *data);
+    void v8_scheduler_remove(v8_scheduler_t *scheduler, v8_scheduler_entry_t *entry);
+    size_t v8_scheduler_shard_count(v8_scheduler_t *scheduler);
+    void v8_scheduler_stats(v8_scheduler_t *scheduler, size_t shard, v8_shard_stats_t *stats);
+    void v8_scheduler_dispose(v8_scheduler_t *scheduler);
+
+    // Snapshot
+    // Functions must be the same when creating the snapshot and when booting from it.
+    v8_snapshot_t v8_snapshot_create(const char *prelude, const v8_snapshot_func_t *funcs, size_t count);
+    void v8_snapshot_free(v8_snapshot_t snapshot);
 
 
 #ifdef __cplusplus
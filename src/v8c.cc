@@ -1,15 +1,234 @@
+#include <mutex>
+#include <deque>
+#include <list>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "v8.h"
 #include "v8c.h"
 #include "libplatform/libplatform.h"
 
+#ifdef V8C_ICU
+    #include "unicode/udata.h"
+#endif
+
 
 ///////////////////////////////////
 //  UTILS
 ///////////////////////////////////
 
 
+#ifdef V8C_STARTUP_DATA
+    // V8 startup snapshot embedded in the library.
+    __asm__(
+        ".section .rodata\n"
+        ".balign 64\n"
+        ".global v8c_startup_data\n"
+        ".hidden v8c_startup_data\n"
+        "v8c_startup_data:\n"
+        ".incbin \"" V8C_STARTUP_DATA "\"\n"
+        ".global v8c_startup_data_end\n"
+        ".hidden v8c_startup_data_end\n"
+        "v8c_startup_data_end:\n"
+        ".previous\n"
+    );
+
+    extern "C" const char v8c_startup_data[];
+    extern "C" const char v8c_startup_data_end[];
+#endif
+
+#ifdef V8C_ICU_DATA
+    // ICU data embedded in the library.
+    __asm__(
+        ".section .rodata\n"
+        ".balign 64\n"
+        ".global v8c_icu_data\n"
+        ".hidden v8c_icu_data\n"
+        "v8c_icu_data:\n"
+        ".incbin \"" V8C_ICU_DATA "\"\n"
+        ".previous\n"
+    );
+
+    extern "C" const char v8c_icu_data[];
+#endif
+
+struct v8_instance_t
+{
+    std::unique_ptr<v8::Platform>   platform;
+    v8::StartupData                 startup_data;       // V8 startup snapshot, when not read by V8.
+    bool                            startup_data_mapped;
+    int                             idle_task_support;
+    std::string                     code_cache_path;    // Empty when the code cache is disabled.
+    v8::StartupData                 snapshot;
+    std::vector<intptr_t>           external_references;
+};
+
+namespace v8impl
+{
+    // Scopes kept alive between v8_isolate_enter and v8_isolate_exit.
+    struct IsolateScope
+    {
+        v8::Locker              locker;
+        v8::Isolate::Scope      isolate_scope;
+        v8::HandleScope         handle_scope;
+
+        IsolateScope(v8::Isolate *isolate) : locker(isolate), isolate_scope(isolate), handle_scope(isolate) {}
+    };
+
+    // Compiled script of the in-memory cache of an isolate.
+    struct ScriptCacheEntry
+    {
+        uint64_t                        hash;
+        std::string                     source;
+        v8::Global<v8::UnboundScript>   script;
+    };
+
+    // Least recently used scripts last.
+    struct ScriptCache
+    {
+        std::list<ScriptCacheEntry>                                                 entries;
+        std::unordered_multimap<uint64_t, std::list<ScriptCacheEntry>::iterator>    index;
+        size_t                                                                      bytes;
+        v8_script_cache_stats_t                                                     stats;
+    };
+
+    // Scopes kept alive between v8_context_enter and v8_context_exit.
+    struct ContextScope
+    {
+        v8::HandleScope         handle_scope;
+        v8::Context::Scope      context_scope;
+
+        ContextScope(v8::Isolate *isolate, const v8::Global<v8::Context> &context)
+            : handle_scope(isolate), context_scope(context.Get(isolate)) {}
+    };
+};
+
+struct v8_key_t
+{
+    v8::Global<v8::String>                                  handle;     // Internalized.
+};
+
+struct v8_context_t
+{
+    v8::Isolate                                             *isolate;
+    v8::Global<v8::Context>                                 handle;
+    std::vector<std::unique_ptr<v8impl::ContextScope>>      scopes;
+    std::unordered_map<std::string, v8::Global<v8::Module>> modules;        // By resolved name, modules keep their context alive.
+    std::unordered_multimap<int, std::string>               module_names;   // By module identity hash.
+};
+
+struct v8_isolate_t
+{
+    v8::Isolate                                             *isolate;
+    v8::ArrayBuffer::Allocator                              *allocator;
+    v8_context_t                                            context;    // Default context.
+    std::vector<std::unique_ptr<v8impl::IsolateScope>>      scopes;
+    void                                                    *data;      // Given to snapshot functions.
+    uint64_t                                                pump_budget;
+    size_t                                                  initial_heap_limit; // Known once the heap limit is first reached.
+    size_t                                                  call_depth;         // JavaScript entered through the binding.
+    v8_isolate_params_t                                     params;
+    v8_module_resolve_cb_t                                  module_resolve_cb;
+    void                                                    *module_resolve_data;
+    v8impl::ScriptCache                                     script_cache;
+    std::unordered_set<uint64_t>                            code_cache_seen;    // Hashes of the code cache entries already read.
+    std::unordered_map<std::string, std::unique_ptr<v8_key_t>>  keys;   // Interned property keys.
+};
+
 namespace v8impl
 {
+    // V8 only supports a single platform per process.
+    static v8_instance_t *instance = nullptr;
+
+    std::vector<intptr_t> ExternalReferences(const v8_snapshot_func_t *funcs, size_t count);
+    v8::MaybeLocal<v8::UnboundScript> CompileUnbound(v8::Isolate *isolate, v8::Local<v8::String> source_string, const char *source_code, size_t length, int flags = V8_COMPILE_DEFAULT);
+    v8::MaybeLocal<v8::UnboundScript> ScriptCacheCompile(v8::Isolate *isolate, const char *source_code, size_t length);
+    void WasmStreamingCallback(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    // Map a file read-only, its pages are shared between processes.
+    bool MapFile(const char *path, const char **data, size_t *length)
+    {
+        struct stat st;
+        int fd = open(path, O_RDONLY);
+
+        if (fd == -1)
+            return (false);
+
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+            close(fd);
+            return (false);
+        }
+
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (addr == MAP_FAILED)
+            return (false);
+
+        *data   = static_cast<const char*>(addr);
+        *length = st.st_size;
+        return (true);
+    }
+
+#ifdef V8C_ICU
+    // Give ICU its common data, as V8 does after reading icudtl.dat.
+    bool IcuSetData(const char *data)
+    {
+        UErrorCode err = U_ZERO_ERROR;
+
+        udata_setCommonData(data, &err);
+        udata_setFileAccess(UDATA_ONLY_PACKAGES, &err);
+        return (U_SUCCESS(err));
+    }
+#endif
+
+    // Embedder data slot of a context pointing to its v8_context_t.
+    static const int kContextSlot = 1;
+
+    // Create the context of a v8_context_t, it can be found back from JavaScript callbacks.
+    void ContextInit(v8_context_t *state, v8::Isolate *isolate)
+    {
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+
+        context->SetAlignedPointerInEmbedderData(kContextSlot, state);
+        state->isolate = isolate;
+        state->handle.Reset(isolate, context);
+    }
+
+    // Null for contexts not created by the binding.
+    v8_context_t *ContextFromV8(v8::Local<v8::Context> context)
+    {
+        if (context->GetNumberOfEmbedderDataFields() <= static_cast<uint32_t>(kContextSlot))
+            return (nullptr);
+
+        return (static_cast<v8_context_t*>(context->GetAlignedPointerFromEmbedderData(kContextSlot)));
+    }
+
+    // Drop the modules of a context along with it, the isolate must be locked.
+    void ContextReset(v8_context_t *state)
+    {
+        state->modules.clear();
+        state->module_names.clear();
+        state->handle.Reset();
+    }
+
     static_assert(
         sizeof(v8::Local<v8::Value>) == sizeof(v8_value_t),
         "Cannot convert between v8::Local<v8::Value> and napi_value"
@@ -35,6 +254,153 @@ namespace v8impl
     {
         return (*reinterpret_cast<v8::Local<v8::Object>*>(&value));
     }
+
+    size_t TypedArrayElementSize(v8_typed_array_t type)
+    {
+        switch (type) {
+            case V8_INT16_ARRAY:
+            case V8_UINT16_ARRAY:       return (2);
+            case V8_INT32_ARRAY:
+            case V8_UINT32_ARRAY:
+            case V8_FLOAT32_ARRAY:      return (4);
+            case V8_FLOAT64_ARRAY:
+            case V8_BIGINT64_ARRAY:
+            case V8_BIGUINT64_ARRAY:    return (8);
+            default:                    return (1);
+        }
+    }
+
+    v8_typed_array_t TypedArrayType(v8::Local<v8::Value> value)
+    {
+        if (value->IsInt8Array())           return (V8_INT8_ARRAY);
+        if (value->IsUint8ClampedArray())   return (V8_UINT8_CLAMPED_ARRAY);
+        if (value->IsInt16Array())          return (V8_INT16_ARRAY);
+        if (value->IsUint16Array())         return (V8_UINT16_ARRAY);
+        if (value->IsInt32Array())          return (V8_INT32_ARRAY);
+        if (value->IsUint32Array())         return (V8_UINT32_ARRAY);
+        if (value->IsFloat32Array())        return (V8_FLOAT32_ARRAY);
+        if (value->IsFloat64Array())        return (V8_FLOAT64_ARRAY);
+        if (value->IsBigInt64Array())       return (V8_BIGINT64_ARRAY);
+        if (value->IsBigUint64Array())      return (V8_BIGUINT64_ARRAY);
+        if (value->IsDataView())            return (V8_DATA_VIEW);
+        return (V8_UINT8_ARRAY);
+    }
+
+    // Bytes of a view starting at element `offset`, at most `count` elements.
+    uint8_t *TypedArrayRange(v8_value_t value, size_t offset, size_t *count)
+    {
+        size_t byte_length;
+        uint8_t *data       = static_cast<uint8_t*>(v8_get_typed_array_data(value, &byte_length));
+        size_t element_size = TypedArrayElementSize(TypedArrayType(V8FromValue(value)));
+        size_t length       = byte_length / element_size;
+
+        // Clamp to the elements of the view.
+        if (data == nullptr || offset >= length) {
+            *count = 0;
+            return (nullptr);
+        }
+
+        *count = std::min(*count, length - offset) * element_size;
+        return (data + offset * element_size);
+    }
+
+    // Create a view of `length` elements over a buffer.
+    v8::Local<v8::ArrayBufferView> TypedArrayNew(v8_typed_array_t type, v8::Local<v8::ArrayBuffer> buffer, size_t offset, size_t length)
+    {
+        switch (type) {
+            case V8_INT8_ARRAY:             return (v8::Int8Array::New(buffer, offset, length));
+            case V8_UINT8_CLAMPED_ARRAY:    return (v8::Uint8ClampedArray::New(buffer, offset, length));
+            case V8_INT16_ARRAY:            return (v8::Int16Array::New(buffer, offset, length));
+            case V8_UINT16_ARRAY:           return (v8::Uint16Array::New(buffer, offset, length));
+            case V8_INT32_ARRAY:            return (v8::Int32Array::New(buffer, offset, length));
+            case V8_UINT32_ARRAY:           return (v8::Uint32Array::New(buffer, offset, length));
+            case V8_FLOAT32_ARRAY:          return (v8::Float32Array::New(buffer, offset, length));
+            case V8_FLOAT64_ARRAY:          return (v8::Float64Array::New(buffer, offset, length));
+            case V8_BIGINT64_ARRAY:         return (v8::BigInt64Array::New(buffer, offset, length));
+            case V8_BIGUINT64_ARRAY:        return (v8::BigUint64Array::New(buffer, offset, length));
+            case V8_DATA_VIEW:              return (v8::DataView::New(buffer, offset, length));
+            default:                        return (v8::Uint8Array::New(buffer, offset, length));
+        }
+    }
+
+    // Kept around JavaScript run by the binding, host functions called meanwhile are nested.
+    struct CallScope
+    {
+        v8_isolate_t *state;
+
+        CallScope(v8::Isolate *isolate) : state(static_cast<v8_isolate_t*>(isolate->GetData(0)))
+        {
+            if (state != nullptr)
+                state->call_depth++;
+        }
+
+        ~CallScope()
+        {
+            if (state != nullptr)
+                state->call_depth--;
+        }
+    };
+
+    inline bool IsolateInCall(v8::Isolate *isolate)
+    {
+        v8_isolate_t *state = static_cast<v8_isolate_t*>(isolate->GetData(0));
+
+        return (state != nullptr && state->call_depth > 0);
+    }
+
+    // Run foreground tasks posted by V8 for at most `budget` microseconds.
+    size_t IsolatePump(v8::Isolate *isolate, uint64_t budget)
+    {
+        CallScope call_scope(isolate);
+        v8::Platform *platform  = instance->platform.get();
+        double deadline         = platform->MonotonicallyIncreasingTime() + budget / 1e6;
+        size_t count            = 0;
+
+        // Run tasks one by one until the budget is spent.
+        while (platform->MonotonicallyIncreasingTime() < deadline) {
+            if (!v8::platform::PumpMessageLoop(platform, isolate))
+                break;
+
+            count++;
+        }
+
+        // Give the remaining time to idle tasks.
+        double remaining = deadline - platform->MonotonicallyIncreasingTime();
+
+        if (instance->idle_task_support && remaining > 0)
+            v8::platform::RunIdleTasks(platform, isolate, remaining);
+
+        return (count);
+    }
+
+    // Pump the current isolate after running JavaScript, when enabled.
+    // Only once back at the outermost call, non nestable tasks must not run under JavaScript frames.
+    inline void IsolateAutoPump(v8::Isolate *isolate)
+    {
+        v8_isolate_t *state = static_cast<v8_isolate_t*>(isolate->GetData(0));
+
+        if (state != nullptr && state->pump_budget > 0 && state->call_depth == 0)
+            IsolatePump(isolate, state->pump_budget);
+    }
+
+    // Run a compiled script, returns undefined when it throws or is terminated.
+    v8::Local<v8::Value> ScriptRun(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Script> script)
+    {
+        // Run the script, the heap limit policy may terminate it.
+        v8::Isolate::SafeForTerminationScope termination_scope(isolate);
+        v8::Local<v8::Value> result_def = static_cast<v8::Local<v8::Value>>(v8::Undefined(isolate));
+        v8::Local<v8::Value> result;
+
+        {
+            CallScope call_scope(isolate);
+            result = script->Run(context).FromMaybe(result_def);
+        }
+
+        // Run tasks posted during the script.
+        IsolateAutoPump(isolate);
+
+        return (result);
+    }
 };
 
 
@@ -45,25 +411,110 @@ namespace v8impl
 
 v8_instance_t *v8_initialize(const char *path)
 {
-    // Initialize external data.
-    v8::V8::InitializeICUDefaultLocation(path);
-    v8::V8::InitializeExternalStartupData(path);
+    v8_config_t config = {};
+
+    return (v8_initialize_config(path, &config));
+}
+
+v8_instance_t *v8_initialize_snapshot(const char *path, v8_snapshot_t snapshot, const v8_snapshot_func_t *funcs, size_t count)
+{
+    v8_config_t config          = {};
+    config.snapshot             = snapshot;
+    config.snapshot_funcs       = funcs;
+    config.snapshot_func_count  = count;
+
+    return (v8_initialize_config(path, &config));
+}
+
+v8_instance_t *v8_initialize_config(const char *path, const v8_config_t *config)
+{
+    // Create new instance.
+    v8_instance_t *instance     = new v8_instance_t();
+    instance->snapshot          = { nullptr, 0 };
+    instance->startup_data      = { nullptr, 0 };
+    instance->idle_task_support = config->idle_task_support;
+
+    if (config->code_cache_path != nullptr)
+        instance->code_cache_path = config->code_cache_path;
+
+    // Initialize ICU data, mapped or embedded its pages are shared between processes, otherwise V8 reads a private copy.
+    bool icu_ready = false;
+
+#ifdef V8C_ICU
+    const char *icu_data;
+    size_t icu_data_size;
+
+    // ICU keeps using the data until the process exits, it is never unmapped.
+    if (config->icu_data_path != nullptr && v8impl::MapFile(config->icu_data_path, &icu_data, &icu_data_size)) {
+        icu_ready = v8impl::IcuSetData(icu_data);
+    } else {
+#ifdef V8C_ICU_DATA
+        icu_ready = v8impl::IcuSetData(v8c_icu_data);
+#endif
+    }
+#endif
+
+    if (!icu_ready)
+        v8::V8::InitializeICUDefaultLocation(path);
+
+    // Initialize startup data, from a mapped file, the library or next to the executable.
+    size_t startup_data_size;
+
+    if (config->startup_data_path != nullptr && v8impl::MapFile(config->startup_data_path, &instance->startup_data.data, &startup_data_size)) {
+        instance->startup_data.raw_size = startup_data_size;
+        instance->startup_data_mapped   = true;
+        v8::V8::SetSnapshotDataBlob(&instance->startup_data);
+    } else {
+#ifdef V8C_STARTUP_DATA
+        instance->startup_data.data     = v8c_startup_data;
+        instance->startup_data.raw_size = v8c_startup_data_end - v8c_startup_data;
+        v8::V8::SetSnapshotDataBlob(&instance->startup_data);
+#else
+        v8::V8::InitializeExternalStartupData(path);
+#endif
+    }
 
-    // Create new instance and assign platform.
-    std::unique_ptr<v8::Platform> platform = v8::platform::NewDefaultPlatform(1);
+    // Create platform, zero worker threads means one per core.
+    instance->platform = v8::platform::NewDefaultPlatform(
+        config->thread_pool_size,
+        config->idle_task_support
+            ? v8::platform::IdleTaskSupport::kEnabled
+            : v8::platform::IdleTaskSupport::kDisabled,
+        config->in_process_stack_dumping
+            ? v8::platform::InProcessStackDumping::kEnabled
+            : v8::platform::InProcessStackDumping::kDisabled
+    );
+
+    // Keep a copy of the snapshot blob, V8 reads it each time an isolate is created.
+    if (config->snapshot.data != nullptr) {
+        char *blob = new char[config->snapshot.size];
+        memcpy(blob, config->snapshot.data, config->snapshot.size);
+
+        instance->snapshot.data         = blob;
+        instance->snapshot.raw_size     = config->snapshot.size;
+        instance->external_references   = v8impl::ExternalReferences(config->snapshot_funcs, config->snapshot_func_count);
+    }
 
     // Initialize V8 engine.
-    v8::V8::InitializePlatform(platform.get());
+    v8::V8::InitializePlatform(instance->platform.get());
     v8::V8::Initialize();
 
-    return (reinterpret_cast<v8_instance_t*>(platform.release()));
+    v8impl::instance = instance;
+    return (instance);
 }
 
 void v8_shutdown(v8_instance_t *instance)
 {
     v8::V8::Dispose();
     v8::V8::ShutdownPlatform();
-    delete (reinterpret_cast<v8::Platform*>(instance));
+
+    v8impl::instance = nullptr;
+    delete[] (instance->snapshot.data);
+
+    if (instance->startup_data_mapped)
+        munmap(const_cast<char*>(instance->startup_data.data), instance->startup_data.raw_size);
+
+    delete (instance);
 }
 
 
@@ -87,6 +538,16 @@ v8_value_t v8_create_int64(int64_t value)
     return (v8impl::ValueFromV8(v8::Number::New(v8::Isolate::GetCurrent(), static_cast<double>(value))));
 }
 
+v8_value_t v8_create_bigint64(int64_t value)
+{
+    return (v8impl::ValueFromV8(v8::BigInt::New(v8::Isolate::GetCurrent(), value)));
+}
+
+v8_value_t v8_create_ubigint64(uint64_t value)
+{
+    return (v8impl::ValueFromV8(v8::BigInt::NewFromUnsigned(v8::Isolate::GetCurrent(), value)));
+}
+
 v8_value_t v8_create_double(double value)
 {
     return (v8impl::ValueFromV8(v8::Number::New(v8::Isolate::GetCurrent(), value)));
@@ -97,31 +558,237 @@ v8_value_t v8_create_array(size_t size)
     return (v8impl::ValueFromV8(v8::Array::New(v8::Isolate::GetCurrent(), size)));
 }
 
-v8_value_t v8_create_uint8_array(size_t size)
+v8_value_t v8_create_array_from_values(v8_value_t *values, size_t count)
 {
-    v8::Isolate *isolate                = v8::Isolate::GetCurrent();
-    v8::Local<v8::ArrayBuffer> buffer   = v8::ArrayBuffer::New(isolate, size);
-    v8::Local<v8::Uint8Array> array     = v8::Uint8Array::New(buffer, 0, size);
+    // Handles share the layout of v8_value_t, the elements are used in place.
+    return (
+        v8impl::ValueFromV8(
+            v8::Array::New(v8::Isolate::GetCurrent(), reinterpret_cast<v8::Local<v8::Value>*>(values), count)
+        )
+    );
+}
+
+v8_value_t v8_create_array_from_doubles(const double *values, size_t count)
+{
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+    v8::EscapableHandleScope scope(isolate);
+    std::vector<v8::Local<v8::Value>> elements(count);
+
+    for (size_t i = 0; i < count; i++)
+        elements[i] = v8::Number::New(isolate, values[i]);
 
-    return (v8impl::ValueFromV8(array));
+    return (v8impl::ValueFromV8(scope.Escape(v8::Array::New(isolate, elements.data(), count))));
 }
 
-v8_value_t v8_create_uint16_array(size_t size)
+v8_value_t v8_create_array_from_int32s(const int32_t *values, size_t count)
 {
-    v8::Isolate *isolate                = v8::Isolate::GetCurrent();
-    v8::Local<v8::ArrayBuffer> buffer   = v8::ArrayBuffer::New(isolate, size);
-    v8::Local<v8::Uint16Array> array    = v8::Uint16Array::New(buffer, 0, size);
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+    v8::EscapableHandleScope scope(isolate);
+    std::vector<v8::Local<v8::Value>> elements(count);
+
+    for (size_t i = 0; i < count; i++)
+        elements[i] = v8::Integer::New(isolate, values[i]);
 
-    return (v8impl::ValueFromV8(array));
+    return (v8impl::ValueFromV8(scope.Escape(v8::Array::New(isolate, elements.data(), count))));
 }
 
-v8_value_t v8_create_uint32_array(size_t size)
+v8_value_t v8_create_array_from_utf8_strings(const char **values, size_t count)
+{
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+    v8::EscapableHandleScope scope(isolate);
+    std::vector<v8::Local<v8::Value>> elements(count);
+
+    for (size_t i = 0; i < count; i++) {
+        v8::Local<v8::String> string;
+
+        if (!v8::String::NewFromUtf8(isolate, values[i]).ToLocal(&string))
+            return (nullptr);
+
+        elements[i] = string;
+    }
+
+    return (v8impl::ValueFromV8(scope.Escape(v8::Array::New(isolate, elements.data(), count))));
+}
+
+v8_value_t v8_create_uint8_array(size_t length)
+{
+    return (v8_create_typed_array(V8_UINT8_ARRAY, length));
+}
+
+v8_value_t v8_create_uint16_array(size_t length)
+{
+    return (v8_create_typed_array(V8_UINT16_ARRAY, length));
+}
+
+v8_value_t v8_create_uint32_array(size_t length)
+{
+    return (v8_create_typed_array(V8_UINT32_ARRAY, length));
+}
+
+v8_value_t v8_create_typed_array(v8_typed_array_t type, size_t length)
 {
     v8::Isolate *isolate                = v8::Isolate::GetCurrent();
-    v8::Local<v8::ArrayBuffer> buffer   = v8::ArrayBuffer::New(isolate, size);
-    v8::Local<v8::Uint32Array> array    = v8::Uint32Array::New(buffer, 0, size);
+    size_t byte_length                  = length * v8impl::TypedArrayElementSize(type);
+    v8::Local<v8::ArrayBuffer> buffer   = v8::ArrayBuffer::New(isolate, byte_length);
+
+    // A DataView is sized in bytes, typed arrays in elements.
+    return (v8impl::ValueFromV8(v8impl::TypedArrayNew(type, buffer, 0, type == V8_DATA_VIEW ? byte_length : length)));
+}
+
+v8_value_t v8_create_bigint64_array(const int64_t *values, size_t count)
+{
+    v8_value_t array = v8_create_typed_array(V8_BIGINT64_ARRAY, count);
+
+    v8_typed_array_write(array, 0, values, count);
+    return (array);
+}
+
+v8_value_t v8_create_biguint64_array(const uint64_t *values, size_t count)
+{
+    v8_value_t array = v8_create_typed_array(V8_BIGUINT64_ARRAY, count);
+
+    v8_typed_array_write(array, 0, values, count);
+    return (array);
+}
+
+struct v8_free_bundle_t
+{
+    v8_free_cb_t    free_cb;
+    void            *hint;
+};
+
+void v8_free_callback(void *data, size_t length, void *deleter_data)
+{
+    v8_free_bundle_t *bundle = static_cast<v8_free_bundle_t*>(deleter_data);
+
+    bundle->free_cb(data, length, bundle->hint);
+    delete (bundle);
+}
+
+v8_value_t v8_create_typed_array_external(v8_typed_array_t type, void *ptr, size_t length, v8_free_cb_t free_cb, void *hint)
+{
+    v8::Isolate *isolate    = v8::Isolate::GetCurrent();
+    size_t byte_length      = length * v8impl::TypedArrayElementSize(type);
+
+    // Wrap host memory without copying, the host is notified once V8 releases it.
+    std::unique_ptr<v8::BackingStore> store;
+
+    if (free_cb != nullptr) {
+        store = v8::ArrayBuffer::NewBackingStore(ptr, byte_length, v8_free_callback, new v8_free_bundle_t { free_cb, hint });
+    } else {
+        store = v8::ArrayBuffer::NewBackingStore(ptr, byte_length, v8::BackingStore::EmptyDeleter, nullptr);
+    }
+
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, std::move(store));
+
+    return (v8impl::ValueFromV8(v8impl::TypedArrayNew(type, buffer, 0, type == V8_DATA_VIEW ? byte_length : length)));
+}
+
+namespace v8impl
+{
+    // Host owned characters, the host is notified once V8 collects the string.
+    template <typename Base, typename Char>
+    class HostString : public Base
+    {
+        public:
+            HostString(const Char *data, size_t length, v8_free_cb_t free_cb, void *hint) :
+                data_(data), length_(length), free_cb_(free_cb), hint_(hint) {}
+
+            ~HostString()
+            {
+                if (free_cb_ != nullptr)
+                    free_cb_(const_cast<Char*>(data_), length_ * sizeof(Char), hint_);
+            }
+
+            const Char *data() const override { return (data_); }
+            size_t length() const override { return (length_); }
+
+            // The string was not created, the characters stay owned by the host.
+            void Disown() { free_cb_ = nullptr; }
+
+        private:
+            const Char      *data_;
+            size_t          length_;
+            v8_free_cb_t    free_cb_;
+            void            *hint_;
+    };
+
+    typedef HostString<v8::String::ExternalOneByteStringResource, char> HostLatin1String;
+    typedef HostString<v8::String::ExternalStringResource, uint16_t> HostTwoByteString;
+
+    void HostFree(void *ptr, size_t length, void *hint)
+    {
+        free(ptr);
+    }
+};
+
+v8_value_t v8_create_string_external_latin1(const char *str, size_t length, v8_free_cb_t free_cb, void *hint)
+{
+    v8::Local<v8::String> string;
+    auto resource = new v8impl::HostLatin1String(str, length, free_cb, hint);
+
+    if (!v8::String::NewExternalOneByte(v8::Isolate::GetCurrent(), resource).ToLocal(&string)) {
+        resource->Disown();
+        delete (resource);
+        return (nullptr);
+    }
+
+    return (v8impl::ValueFromV8(string));
+}
+
+v8_value_t v8_create_string_external_utf16(const char16_t *str, size_t length, v8_free_cb_t free_cb, void *hint)
+{
+    v8::Local<v8::String> string;
+    auto resource = new v8impl::HostTwoByteString(reinterpret_cast<const uint16_t*>(str), length, free_cb, hint);
 
-    return (v8impl::ValueFromV8(array));
+    if (!v8::String::NewExternalTwoByte(v8::Isolate::GetCurrent(), resource).ToLocal(&string)) {
+        resource->Disown();
+        delete (resource);
+        return (nullptr);
+    }
+
+    return (v8impl::ValueFromV8(string));
+}
+
+int v8_string_externalize(v8_value_t value)
+{
+    v8::Isolate *isolate        = v8::Isolate::GetCurrent();
+    v8::Local<v8::Value> val    = v8impl::V8FromValue(value);
+
+    if (!val->IsString())
+        return (0);
+
+    v8::Local<v8::String> string = val.As<v8::String>();
+
+    if (string->IsExternal() || !string->CanMakeExternal())
+        return (0);
+
+    // Move the characters off the JavaScript heap, the heap copy is reclaimed on the next GC.
+    size_t length = string->Length();
+
+    if (string->IsOneByte()) {
+        uint8_t *data = static_cast<uint8_t*>(malloc(length + 1));
+        string->WriteOneByte(isolate, data);
+
+        auto resource = new v8impl::HostLatin1String(reinterpret_cast<char*>(data), length, v8impl::HostFree, nullptr);
+
+        if (!string->MakeExternal(resource)) {
+            delete (resource);
+            return (0);
+        }
+    } else {
+        uint16_t *data = static_cast<uint16_t*>(malloc((length + 1) * sizeof(uint16_t)));
+        string->Write(isolate, data);
+
+        auto resource = new v8impl::HostTwoByteString(data, length, v8impl::HostFree, nullptr);
+
+        if (!string->MakeExternal(resource)) {
+            delete (resource);
+            return (0);
+        }
+    }
+
+    return (1);
 }
 
 v8_value_t v8_create_string_utf8(const char *str)
@@ -145,6 +812,28 @@ v8_value_t v8_create_string_utf16(const char16_t *str)
     );
 }
 
+v8_key_t *v8_intern_key(const char *name, size_t length)
+{
+    v8::Isolate *isolate    = v8::Isolate::GetCurrent();
+    v8_isolate_t *state     = static_cast<v8_isolate_t*>(isolate->GetData(0));
+    std::string key(name, length);
+    auto it                 = state->keys.find(key);
+
+    // Keys live as long as the isolate, repeated lookups skip hashing and internalizing.
+    if (it != state->keys.end())
+        return (it->second.get());
+
+    v8::Local<v8::String> string;
+
+    if (!v8::String::NewFromUtf8(isolate, name, v8::NewStringType::kInternalized, length).ToLocal(&string))
+        return (nullptr);
+
+    v8_key_t *interned = new v8_key_t { v8::Global<v8::String>(isolate, string) };
+    state->keys.emplace(std::move(key), std::unique_ptr<v8_key_t>(interned));
+
+    return (interned);
+}
+
 v8_value_t v8_create_object()
 {
     return (v8impl::ValueFromV8(v8::Object::New(v8::Isolate::GetCurrent())));
@@ -177,50 +866,205 @@ v8_value_t v8_get_ref_value(v8_value_t ref)
     return (v8impl::ValueFromV8(value));
 }
 
-size_t v8_get_utf8(v8_value_t value, char *buf, size_t len)
+void *v8_get_typed_array_data(v8_value_t value, size_t *byte_length)
 {
     v8::Local<v8::Value> val = v8impl::V8FromValue(value);
 
-    return (
-        val.As<v8::String>()->WriteUtf8(
-            v8::Isolate::GetCurrent(),
-            buf,
-            len,
-            nullptr,
-            v8::String::REPLACE_INVALID_UTF8
-        )
-    );
+    // Plain buffers start at their first byte.
+    if (val->IsArrayBuffer()) {
+        std::shared_ptr<v8::BackingStore> store = val.As<v8::ArrayBuffer>()->GetBackingStore();
+
+        *byte_length = store->ByteLength();
+        return (store->Data());
+    }
+
+    if (!val->IsArrayBufferView()) {
+        *byte_length = 0;
+        return (nullptr);
+    }
+
+    v8::Local<v8::ArrayBufferView> view     = val.As<v8::ArrayBufferView>();
+    std::shared_ptr<v8::BackingStore> store = view->Buffer()->GetBackingStore();
+
+    *byte_length = view->ByteLength();
+    return (static_cast<uint8_t*>(store->Data()) + view->ByteOffset());
 }
 
-void v8_get_callback_args(v8_callback_info_t cb_info, v8_value_t* args, int argc)
+size_t v8_typed_array_write(v8_value_t array, size_t offset, const void *src, size_t count)
 {
-    auto JsArgs = *reinterpret_cast<const v8::FunctionCallbackInfo<v8::Value>*>(cb_info);
+    size_t bytes    = count;
+    uint8_t *dst    = v8impl::TypedArrayRange(array, offset, &bytes);
 
-    for (int i = 0; i < argc; i++)
-        args[i] = v8impl::ValueFromV8(JsArgs[i]);
+    if (dst != nullptr)
+        memcpy(dst, src, bytes);
+
+    return (bytes);
 }
 
+size_t v8_typed_array_read(v8_value_t array, size_t offset, void *dst, size_t count)
+{
+    size_t bytes    = count;
+    uint8_t *src    = v8impl::TypedArrayRange(array, offset, &bytes);
 
-///////////////////////////////////
-//  SETTERS
-///////////////////////////////////
+    if (src != nullptr)
+        memcpy(dst, src, bytes);
 
+    return (bytes);
+}
 
-void v8_set_obj_var(v8_value_t obj, const char *key, v8_value_t value)
+v8_value_t v8_get_obj_key(v8_value_t obj, v8_key_t *key)
 {
     v8::Isolate *isolate            = v8::Isolate::GetCurrent();
     v8::Local<v8::Context> context  = isolate->GetCurrentContext();
-    v8::Local<v8::Object> object    = context->Global();
+    v8::Local<v8::Object> object    = v8impl::V8ObjectFromValue(obj);
+    v8::Local<v8::Value> value;
 
-    object->Set(
-        context,
-        v8::String::NewFromUtf8(isolate, key).ToLocalChecked(),
-        v8impl::V8FromValue(value)
-    ).FromJust();
+    if (!object->Get(context, key->handle.Get(isolate)).ToLocal(&value))
+        return (nullptr);
+
+    return (v8impl::ValueFromV8(value));
 }
 
+v8_value_t v8_get_array_element(v8_value_t array, uint32_t index)
+{
+    v8::Local<v8::Context> context  = v8::Isolate::GetCurrent()->GetCurrentContext();
+    v8::Local<v8::Value> value;
 
-///////////////////////////////////
+    if (!v8impl::V8ObjectFromValue(array)->Get(context, index).ToLocal(&value))
+        return (nullptr);
+
+    return (v8impl::ValueFromV8(value));
+}
+
+int64_t v8_get_int64(v8_value_t value, int *lossless)
+{
+    v8::Local<v8::Value> val    = v8impl::V8FromValue(value);
+    bool exact                  = true;
+    int64_t result              = 0;
+
+    // BigInts keep every bit, plain numbers are truncated toward zero.
+    if (val->IsBigInt()) {
+        result = val.As<v8::BigInt>()->Int64Value(&exact);
+    } else if (val->IsNumber()) {
+        double number = val.As<v8::Number>()->Value();
+
+        // Check the range on the double, converting out of range values is undefined.
+        if (number >= -0x1p63 && number < 0x1p63) {
+            result  = static_cast<int64_t>(number);
+            exact   = std::trunc(number) == number;
+        } else {
+            result  = std::isnan(number) ? 0 : (number > 0) ? INT64_MAX : INT64_MIN;
+            exact   = false;
+        }
+    } else {
+        exact = false;
+    }
+
+    if (lossless != nullptr)
+        *lossless = exact;
+
+    return (result);
+}
+
+uint64_t v8_get_uint64(v8_value_t value, int *lossless)
+{
+    v8::Local<v8::Value> val = v8impl::V8FromValue(value);
+
+    if (val->IsBigInt()) {
+        bool exact;
+        uint64_t result = val.As<v8::BigInt>()->Uint64Value(&exact);
+
+        if (lossless != nullptr)
+            *lossless = exact;
+
+        return (result);
+    }
+
+    if (val->IsNumber()) {
+        double number = val.As<v8::Number>()->Value();
+        bool exact;
+        uint64_t result;
+
+        if (number >= 0 && number < 0x1p64) {
+            result  = static_cast<uint64_t>(number);
+            exact   = std::trunc(number) == number;
+        } else {
+            result  = (number > 0) ? UINT64_MAX : 0;
+            exact   = false;
+        }
+
+        if (lossless != nullptr)
+            *lossless = exact;
+
+        return (result);
+    }
+
+    if (lossless != nullptr)
+        *lossless = 0;
+
+    return (0);
+}
+
+size_t v8_get_utf8(v8_value_t value, char *buf, size_t len)
+{
+    v8::Local<v8::Value> val = v8impl::V8FromValue(value);
+
+    return (
+        val.As<v8::String>()->WriteUtf8(
+            v8::Isolate::GetCurrent(),
+            buf,
+            len,
+            nullptr,
+            v8::String::REPLACE_INVALID_UTF8
+        )
+    );
+}
+
+void v8_get_callback_args(v8_callback_info_t cb_info, v8_value_t* args, int argc)
+{
+    auto JsArgs = *reinterpret_cast<const v8::FunctionCallbackInfo<v8::Value>*>(cb_info);
+
+    for (int i = 0; i < argc; i++)
+        args[i] = v8impl::ValueFromV8(JsArgs[i]);
+}
+
+
+///////////////////////////////////
+//  SETTERS
+///////////////////////////////////
+
+
+void v8_set_obj_var(v8_value_t obj, const char *key, v8_value_t value)
+{
+    v8::Isolate *isolate            = v8::Isolate::GetCurrent();
+    v8::Local<v8::Context> context  = isolate->GetCurrentContext();
+    v8::Local<v8::Object> object    = v8impl::V8ObjectFromValue(obj);
+
+    object->Set(
+        context,
+        v8::String::NewFromUtf8(isolate, key).ToLocalChecked(),
+        v8impl::V8FromValue(value)
+    ).FromJust();
+}
+
+void v8_set_obj_key(v8_value_t obj, v8_key_t *key, v8_value_t value)
+{
+    v8::Isolate *isolate            = v8::Isolate::GetCurrent();
+    v8::Local<v8::Context> context  = isolate->GetCurrentContext();
+    v8::Local<v8::Object> object    = v8impl::V8ObjectFromValue(obj);
+
+    object->Set(context, key->handle.Get(isolate), v8impl::V8FromValue(value)).FromJust();
+}
+
+void v8_set_array_element(v8_value_t array, uint32_t index, v8_value_t value)
+{
+    v8::Local<v8::Context> context  = v8::Isolate::GetCurrent()->GetCurrentContext();
+
+    v8impl::V8ObjectFromValue(array)->Set(context, index, v8impl::V8FromValue(value)).FromJust();
+}
+
+
+///////////////////////////////////
 //  FUNCTIONS
 ///////////////////////////////////
 
@@ -241,6 +1085,17 @@ void v8_callback_function(const v8::FunctionCallbackInfo<v8::Value>& args)
     bundle.func_cb(cb_info, args.Length(), bundle.data);
 }
 
+void v8_snapshot_callback_function(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    // The callback is stored as is so that it can be serialized in a snapshot.
+    v8_func_cb_t func_cb        =   reinterpret_cast<v8_func_cb_t>(v8::Local<v8::External>::Cast(args.Data())->Value());
+    v8_isolate_t *state         =   static_cast<v8_isolate_t*>(args.GetIsolate()->GetData(0));
+    v8_callback_info_t cb_info  =   reinterpret_cast<v8_callback_info_t>(&args);
+
+    // Call callback with the data given to v8_isolate_run or v8_isolate_set_data, none while creating the snapshot.
+    func_cb(cb_info, args.Length(), state != nullptr ? state->data : nullptr);
+}
+
 v8_value_t v8_create_function(v8_func_cb_t cb, void *data)
 {
     // Get current isolate and current context.
@@ -272,20 +1127,33 @@ v8_value_t v8_call_function(v8_value_t func, v8_value_t *args, size_t count)
     v8::Isolate *isolate                = v8::Isolate::GetCurrent();
 
     // Enter a new scope before calling the function to prevent memory grow.
-    v8::HandleScope scope(isolate);
+    v8::EscapableHandleScope scope(isolate);
+
+    // Allow the heap limit policy to terminate the call.
+    v8::Isolate::SafeForTerminationScope termination_scope(isolate);
 
     v8::Local<v8::Context> context      = isolate->GetCurrentContext();
     v8::Local<v8::Function> function    = v8::Local<v8::Function>::Cast(v8impl::V8FromValue(func));
+    v8::Local<v8::Value> result_def     = static_cast<v8::Local<v8::Value>>(v8::Undefined(isolate));
+
+    v8::Local<v8::Value> result;
 
     // Call Javascript function.
-    return (v8impl::ValueFromV8(
-        function->Call(
+    {
+        v8impl::CallScope call_scope(isolate);
+
+        result = function->Call(
             context,
             v8::Undefined(isolate),
             count,
             reinterpret_cast<v8::Local<v8::Value>*>(args)
-        ).ToLocalChecked()
-    ));
+        ).FromMaybe(result_def);
+    }
+
+    // Run tasks posted during the call.
+    v8impl::IsolateAutoPump(isolate);
+
+    return (v8impl::ValueFromV8(scope.Escape(result)));
 }
 
 
@@ -294,43 +1162,294 @@ v8_value_t v8_call_function(v8_value_t func, v8_value_t *args, size_t count)
 ///////////////////////////////////
 
 
-void v8_isolate_start(v8_start_cb_t start_cb, void *data)
+namespace v8impl
 {
-    // Create allocator.
-    v8::ArrayBuffer::Allocator *allocator = v8::ArrayBuffer::Allocator::NewDefaultAllocator();
+    // A heap limit callback is only installed along a policy.
+    bool IsolateParamsValid(const v8_isolate_params_t *params)
+    {
+        return (params == nullptr || params->heap_limit_cb == nullptr || params->heap_limit_policy != V8_HEAP_LIMIT_DEFAULT);
+    }
+
+    // Apply the heap limit policy of an isolate.
+    size_t NearHeapLimit(void *data, size_t current_heap_limit, size_t initial_heap_limit)
+    {
+        v8_isolate_t *state                 = static_cast<v8_isolate_t*>(data);
+        const v8_isolate_params_t &params   = state->params;
+
+        state->initial_heap_limit = initial_heap_limit;
 
-    // Create params.
-    v8::Isolate::CreateParams create_params;
-    create_params.array_buffer_allocator        = allocator;
-    create_params.only_terminate_in_safe_scope  = true;
+        // Headroom given to the isolate to finish its work, or unwind when terminated.
+        // Only growth is kept, other policies go back to the initial limit once the heap shrinks.
+        size_t growth = params.heap_limit_growth ? params.heap_limit_growth : initial_heap_limit / 4;
 
-    // Create isolate and enter.
-    v8::Isolate *isolate = v8::Isolate::New(create_params);
+        if (params.heap_limit_policy == V8_HEAP_LIMIT_TERMINATE)
+            state->isolate->TerminateExecution();
 
-    // Capture uncaught exceptions.
-    isolate->SetCaptureStackTraceForUncaughtExceptions(true);
+        // Report to the host, it must release references when evicting.
+        if (params.heap_limit_cb != nullptr)
+            params.heap_limit_cb(state, params.heap_limit_policy, current_heap_limit, initial_heap_limit, params.heap_limit_data);
+
+        return (current_heap_limit + growth);
+    }
 
-    // Create a sub stack to enter isolate.
+    v8_isolate_t *IsolateNew(const v8_isolate_params_t *params)
     {
-        // Create a stack-allocated isolate scope.
-        v8::Isolate::Scope isolate_scope(isolate);
+        v8_isolate_t *state = new v8_isolate_t();
+
+        if (params != nullptr)
+            state->params = *params;
+
+        // Create allocator.
+        state->allocator = v8::ArrayBuffer::Allocator::NewDefaultAllocator();
+
+        // Create params.
+        v8::Isolate::CreateParams create_params;
+        create_params.array_buffer_allocator        = state->allocator;
+        create_params.only_terminate_in_safe_scope  = true;
+
+        // Heap sizing, zero keeps the V8 default.
+        v8::ResourceConstraints &constraints = create_params.constraints;
+
+        if (state->params.initial_old_generation_size)
+            constraints.set_initial_old_generation_size_in_bytes(state->params.initial_old_generation_size);
+        if (state->params.max_old_generation_size)
+            constraints.set_max_old_generation_size_in_bytes(state->params.max_old_generation_size);
+        if (state->params.initial_young_generation_size)
+            constraints.set_initial_young_generation_size_in_bytes(state->params.initial_young_generation_size);
+        if (state->params.max_young_generation_size)
+            constraints.set_max_young_generation_size_in_bytes(state->params.max_young_generation_size);
+
+        // Boot from the custom snapshot, if any.
+        if (instance->snapshot.data != nullptr) {
+            create_params.snapshot_blob         = &instance->snapshot;
+            create_params.external_references   = instance->external_references.data();
+        }
+
+        // Create isolate.
+        state->isolate          = v8::Isolate::New(create_params);
+        state->context.isolate  = state->isolate;
+        state->isolate->SetData(0, state);
+
+        // Capture uncaught exceptions.
+        state->isolate->SetCaptureStackTraceForUncaughtExceptions(true);
+
+        // Feed WebAssembly.compileStreaming from the host.
+        state->isolate->SetWasmStreamingCallback(WasmStreamingCallback);
+
+        // Install the heap limit policy.
+        if (state->params.heap_limit_policy != V8_HEAP_LIMIT_DEFAULT)
+            state->isolate->AddNearHeapLimitCallback(NearHeapLimit, state);
+
+        // The maximum heap size keeps bounding memory when only terminating or evicting.
+        if (state->params.heap_limit_policy == V8_HEAP_LIMIT_TERMINATE || state->params.heap_limit_policy == V8_HEAP_LIMIT_EVICT)
+            state->isolate->AutomaticallyRestoreInitialHeapLimit();
 
-        // Create a stack-allocated handle scope.
+        return (state);
+    }
+
+    // Replace the context of an isolate by a fresh one, callable from any thread.
+    void IsolateResetContext(v8_isolate_t *state)
+    {
+        v8::Isolate *isolate = state->isolate;
+
+        // Lock the isolate for the current thread and enter it.
+        v8::Locker locker(isolate);
+        v8::Isolate::Scope isolate_scope(isolate);
         v8::HandleScope handle_scope(isolate);
 
+        // Drop the previous context and its modules, if any.
+        if (!state->context.handle.IsEmpty()) {
+            ContextReset(&state->context);
+            isolate->ContextDisposedNotification();
+            isolate->CancelTerminateExecution();
+        }
+
         // Create a new context.
-        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        ContextInit(&state->context, isolate);
+    }
 
-        // Enter the context for compiling and running the hello world script.
-        v8::Context::Scope context_scope(context);
+    // Forget what the previous user of a pooled isolate configured, callable from any thread.
+    void IsolateRecycle(v8_isolate_t *state)
+    {
+        v8::Locker locker(state->isolate);
+        v8::Isolate::Scope isolate_scope(state->isolate);
+
+        state->data                 = nullptr;
+        state->module_resolve_cb    = nullptr;
+        state->module_resolve_data  = nullptr;
+        state->pump_budget          = 0;
+
+        // Bring back the heap limit raised by the heap limit policy.
+        if (state->initial_heap_limit) {
+            state->isolate->RemoveNearHeapLimitCallback(NearHeapLimit, state->initial_heap_limit);
+            state->isolate->AddNearHeapLimitCallback(NearHeapLimit, state);
+            state->initial_heap_limit = 0;
+
+            if (state->params.heap_limit_policy != V8_HEAP_LIMIT_GROW)
+                state->isolate->AutomaticallyRestoreInitialHeapLimit();
+        }
+    }
+
+    void IsolateDispose(v8_isolate_t *state)
+    {
+        // Release the context while holding the isolate.
+        {
+            v8::Locker locker(state->isolate);
+            v8::Isolate::Scope isolate_scope(state->isolate);
+
+            state->script_cache.entries.clear();
+            state->keys.clear();
+            ContextReset(&state->context);
+        }
+
+        // Notify platform to drop pending tasks of the isolate.
+        if (v8impl::instance != nullptr)
+            v8::platform::NotifyIsolateShutdown(v8impl::instance->platform.get(), state->isolate);
+
+        // Dispose isolate and delete allocator.
+        state->isolate->Dispose();
+        delete (state->allocator);
+        delete (state);
+    }
+};
+
+void v8_isolate_start(v8_start_cb_t start_cb, void *data)
+{
+    // Create isolate with a new context.
+    v8_isolate_t *isolate = v8_isolate_new();
+
+    // Call init callback inside the isolate.
+    v8_isolate_run(isolate, start_cb, data);
+
+    // Dispose isolate.
+    v8impl::IsolateDispose(isolate);
+}
+
+void v8_isolate_run(v8_isolate_t *isolate, v8_start_cb_t start_cb, void *data)
+{
+    // Enter the isolate, it may have been prepared by another thread.
+    v8_isolate_enter(isolate);
+    v8_value_t global = v8_context_enter(&isolate->context);
+
+    // Data given to snapshot functions, only while the callback runs.
+    void *previous  = isolate->data;
+    isolate->data   = data;
+
+    // Call init callback.
+    start_cb(global, data);
+
+    isolate->data = previous;
+    v8_context_exit(&isolate->context);
+    v8_isolate_exit(isolate);
+}
+
+v8_isolate_t *v8_isolate_new()
+{
+    return (v8_isolate_new_params(nullptr));
+}
+
+v8_isolate_t *v8_isolate_new_params(const v8_isolate_params_t *params)
+{
+    if (!v8impl::IsolateParamsValid(params))
+        return (nullptr);
+
+    v8_isolate_t *isolate = v8impl::IsolateNew(params);
+    v8impl::IsolateResetContext(isolate);
+
+    return (isolate);
+}
 
-        // Call init callback.
-        start_cb(v8impl::ValueFromV8(context->Global()), data);
+void v8_isolate_enter(v8_isolate_t *isolate)
+{
+    // Lock the isolate for the current thread and enter it.
+    isolate->scopes.push_back(std::make_unique<v8impl::IsolateScope>(isolate->isolate));
+
+    // The stack limit depends on the thread entering the isolate.
+    if (isolate->params.stack_size) {
+        uintptr_t here = reinterpret_cast<uintptr_t>(&here);
+        isolate->isolate->SetStackLimit(here - isolate->params.stack_size);
     }
+}
+
+void v8_isolate_set_data(v8_isolate_t *isolate, void *data)
+{
+    isolate->data = data;
+}
+
+void v8_isolate_exit(v8_isolate_t *isolate)
+{
+    // Take the scope out first, the lock must only be released once the stack is updated.
+    std::unique_ptr<v8impl::IsolateScope> scope = std::move(isolate->scopes.back());
+    isolate->scopes.pop_back();
+}
+
+void v8_isolate_unlocked(v8_isolate_t *isolate, v8_unlocked_cb_t cb, void *data)
+{
+    // Let other threads enter the isolate while the callback runs.
+    v8::Unlocker unlocker(isolate->isolate);
+
+    cb(data);
+}
+
+int v8_isolate_is_locked(v8_isolate_t *isolate)
+{
+    return (v8::Locker::IsLocked(isolate->isolate));
+}
+
+size_t v8_isolate_pump(v8_isolate_t *isolate, uint64_t budget)
+{
+    return (v8impl::IsolatePump(isolate->isolate, budget));
+}
+
+void v8_isolate_set_pump_budget(v8_isolate_t *isolate, uint64_t budget)
+{
+    isolate->pump_budget = budget;
+}
+
+void v8_isolate_dispose(v8_isolate_t *isolate)
+{
+    v8impl::IsolateDispose(isolate);
+}
+
+v8_context_t *v8_isolate_context(v8_isolate_t *isolate)
+{
+    return (&isolate->context);
+}
 
-    // Dispose isolate and delete allocator.
-    isolate->Dispose();
-    delete (allocator);
+v8_context_t *v8_context_new()
+{
+    // Create a new context in the current isolate.
+    v8_context_t *context = new v8_context_t();
+    v8impl::ContextInit(context, v8::Isolate::GetCurrent());
+
+    return (context);
+}
+
+v8_value_t v8_context_enter(v8_context_t *context)
+{
+    // Open a handle scope and enter the context.
+    context->scopes.push_back(std::make_unique<v8impl::ContextScope>(context->isolate, context->handle));
+
+    return (v8impl::ValueFromV8(context->isolate->GetCurrentContext()->Global()));
+}
+
+void v8_context_exit(v8_context_t *context)
+{
+    context->scopes.pop_back();
+}
+
+void v8_context_dispose(v8_context_t *context)
+{
+    v8_isolate_t *state = static_cast<v8_isolate_t*>(context->isolate->GetData(0));
+
+    // The default context lives in the isolate, it is released with it.
+    if (state != nullptr && context == &state->context)
+        return;
+
+    v8impl::ContextReset(context);
+    context->isolate->ContextDisposedNotification();
+
+    delete (context);
 }
 
 v8_value_t v8_script_run(const char *source_code)
@@ -339,27 +1458,1752 @@ v8_value_t v8_script_run(const char *source_code)
     v8::Isolate *isolate            = v8::Isolate::GetCurrent();
     v8::Local<v8::Context> context  = isolate->GetCurrentContext();
 
-    // @TODO modules
-    // v8::Module::InstantiateModule(context);
+    // Compile the source code and detect errors, through the script caches when enabled.
+    v8::MaybeLocal<v8::UnboundScript> maybe_script = v8impl::ScriptCacheCompile(isolate, source_code, strlen(source_code));
+
+    if (maybe_script.IsEmpty()) {
+        return (nullptr);
+    }
+
+    // Run the script and return result.
+    v8::Local<v8::Script> script = maybe_script.ToLocalChecked()->BindToCurrentContext();
+    return (v8impl::ValueFromV8(v8impl::ScriptRun(isolate, context, script)));
+}
+
+
+///////////////////////////////////
+//  SCRIPTS
+///////////////////////////////////
+
+
+namespace v8impl
+{
+    static std::atomic<uint64_t> code_cache_hits(0);
+    static std::atomic<uint64_t> code_cache_misses(0);
+    static std::atomic<uint64_t> code_cache_rejects(0);
+
+    // FNV-1a, fast enough to key caches on source bytes.
+    uint64_t Hash(const char *data, size_t length)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+
+        for (size_t i = 0; i < length; i++) {
+            hash ^= static_cast<uint8_t>(data[i]);
+            hash *= 0x100000001b3ULL;
+        }
+
+        return (hash);
+    }
+
+    // Cache entries are keyed by kind, source, V8 version and the flags V8 was started with.
+    std::string CodeCachePath(const char *kind, const char *source, size_t length)
+    {
+        char name[128];
+
+        snprintf(
+            name, sizeof(name), "/%s-%d.%d.%d.%d-%08x-%016llx-%zu.v8cache",
+            kind, V8_MAJOR_VERSION, V8_MINOR_VERSION, V8_BUILD_NUMBER, V8_PATCH_LEVEL,
+            v8::ScriptCompiler::CachedDataVersionTag(),
+            static_cast<unsigned long long>(Hash(source, length)),
+            length
+        );
+
+        return (instance->code_cache_path + name);
+    }
+
+    v8::ScriptCompiler::CachedData *CodeCacheLoad(const std::string &path)
+    {
+        struct stat st;
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd == -1)
+            return (nullptr);
+
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+            close(fd);
+            return (nullptr);
+        }
+
+        // Read the whole entry, the cached data owns the buffer.
+        uint8_t *buf    = new uint8_t[st.st_size];
+        ssize_t len     = read(fd, buf, st.st_size);
+        close(fd);
+
+        if (len != st.st_size) {
+            delete[] (buf);
+            return (nullptr);
+        }
+
+        return (new v8::ScriptCompiler::CachedData(buf, len, v8::ScriptCompiler::CachedData::BufferOwned));
+    }
+
+    void CodeCacheStore(const std::string &path, v8::ScriptCompiler::CachedData *data)
+    {
+        if (data == nullptr)
+            return;
+
+        // Write to a temporary file first so that readers never see a partial entry, unique per writer thread.
+        std::string tmp = path + ".XXXXXX";
+        int fd          = mkstemp(&tmp[0]);
+
+        if (fd != -1) {
+            bool written = fchmod(fd, 0644) == 0 && write(fd, data->data, data->length) == data->length;
+            close(fd);
+
+            if (!written || rename(tmp.c_str(), path.c_str()) == -1)
+                unlink(tmp.c_str());
+        }
+
+        delete (data);
+    }
+
+    // Compile through the on-disk code cache at the given path, shared by scripts and modules.
+    template <typename T, typename Compile, typename CreateCache>
+    v8::MaybeLocal<T> CodeCacheCompile(v8::Isolate *isolate, const std::string &path, v8::ScriptCompiler::CompileOptions compile_options, Compile compile, CreateCache create_cache)
+    {
+        v8_isolate_t *state = static_cast<v8_isolate_t*>(isolate->GetData(0));
+
+        // The disk is read once per entry and isolate, V8 finds the source in its compilation cache afterwards.
+        if (state != nullptr && !state->code_cache_seen.insert(Hash(path.data(), path.size())).second) {
+            bool rejected = false;
+            return (compile(nullptr, compile_options, &rejected));
+        }
+
+        v8::ScriptCompiler::CachedData *cached_data     = CodeCacheLoad(path);
+        v8::ScriptCompiler::CompileOptions options      = cached_data
+            ? v8::ScriptCompiler::kConsumeCodeCache
+            : compile_options;
+
+        // The source given to compile takes ownership of the cached data.
+        bool rejected = false;
+        v8::Local<T> result;
+
+        if (!compile(cached_data, options, &rejected).ToLocal(&result))
+            return (result);
+
+        if (cached_data == nullptr) {
+            code_cache_misses++;
+        } else if (rejected) {
+            code_cache_rejects++;
+        } else {
+            code_cache_hits++;
+            return (result);
+        }
+
+        // Generate the entry on miss, or replace the rejected one.
+        CodeCacheStore(path, create_cache(result));
+        return (result);
+    }
+
+    // Eager entries hold every function, they are kept apart from lazy ones.
+    const char *CodeCacheKind(int flags)
+    {
+        return ((flags & V8_COMPILE_EAGER) ? "script-eager" : "script");
+    }
+
+    // Compile a script, going through the on-disk code cache when enabled.
+    v8::MaybeLocal<v8::UnboundScript> CompileUnbound(v8::Isolate *isolate, v8::Local<v8::String> source_string, const char *source_code, size_t length, int flags)
+    {
+        // Compile every function upfront instead of on first call.
+        v8::ScriptCompiler::CompileOptions compile_options = (flags & V8_COMPILE_EAGER)
+            ? v8::ScriptCompiler::kEagerCompile
+            : v8::ScriptCompiler::kNoCompileOptions;
+
+        if (instance->code_cache_path.empty()) {
+            v8::ScriptCompiler::Source source(source_string);
+            return (v8::ScriptCompiler::CompileUnboundScript(isolate, &source, compile_options));
+        }
+
+        return (CodeCacheCompile<v8::UnboundScript>(
+            isolate, CodeCachePath(CodeCacheKind(flags), source_code, length), compile_options,
+            [&](v8::ScriptCompiler::CachedData *cached_data, v8::ScriptCompiler::CompileOptions options, bool *rejected) {
+                v8::ScriptCompiler::Source source(source_string, cached_data);
+                v8::MaybeLocal<v8::UnboundScript> unbound = v8::ScriptCompiler::CompileUnboundScript(isolate, &source, options);
+
+                *rejected = cached_data != nullptr && source.GetCachedData()->rejected;
+                return (unbound);
+            },
+            [](v8::Local<v8::UnboundScript> unbound) {
+                return (v8::ScriptCompiler::CreateCodeCache(unbound));
+            }
+        ));
+    }
+};
+
+namespace v8impl
+{
+    // Compile through the in-memory cache of the isolate when enabled.
+    // Compile from the source bytes, the source string is only created when the script is not cached.
+    v8::MaybeLocal<v8::UnboundScript> ScriptCacheCompile(v8::Isolate *isolate, const char *source_code, size_t length)
+    {
+        v8_isolate_t *state = static_cast<v8_isolate_t*>(isolate->GetData(0));
+        v8::Local<v8::String> source_string;
+
+        if (state == nullptr || state->params.script_cache_count == 0) {
+            if (!v8::String::NewFromUtf8(isolate, source_code, v8::NewStringType::kNormal, length).ToLocal(&source_string))
+                return (v8::MaybeLocal<v8::UnboundScript>());
+
+            return (CompileUnbound(isolate, source_string, source_code, length));
+        }
+
+        ScriptCache &cache  = state->script_cache;
+        uint64_t hash       = Hash(source_code, length);
+        auto range          = cache.index.equal_range(hash);
+
+        // Hash hits are confirmed against the source bytes.
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second->source.compare(0, std::string::npos, source_code, length) == 0) {
+                cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+                cache.stats.hits++;
+
+                return (it->second->script.Get(isolate));
+            }
+        }
+
+        cache.stats.misses++;
+
+        v8::Local<v8::UnboundScript> unbound;
+
+        if (!v8::String::NewFromUtf8(isolate, source_code, v8::NewStringType::kNormal, length).ToLocal(&source_string)
+            || !CompileUnbound(isolate, source_string, source_code, length).ToLocal(&unbound))
+            return (unbound);
+
+        // Insert as most recently used.
+        cache.entries.push_front({ hash, std::string(source_code, length), v8::Global<v8::UnboundScript>(isolate, unbound) });
+        cache.index.emplace(hash, cache.entries.begin());
+        cache.bytes += length;
+
+        // Evict least recently used scripts while over bounds.
+        while (cache.entries.size() > state->params.script_cache_count
+            || (state->params.script_cache_bytes && cache.bytes > state->params.script_cache_bytes && cache.entries.size() > 1)) {
+            ScriptCacheEntry &entry = cache.entries.back();
+            auto slots              = cache.index.equal_range(entry.hash);
+
+            for (auto it = slots.first; it != slots.second; it++) {
+                if (&*it->second == &entry) {
+                    cache.index.erase(it);
+                    break;
+                }
+            }
+
+            cache.bytes -= entry.source.size();
+            cache.entries.pop_back();
+            cache.stats.evictions++;
+        }
+
+        return (unbound);
+    }
+};
+
+struct v8_script_t
+{
+    v8::Isolate                     *isolate;
+    v8::Global<v8::UnboundScript>   handle;
+    std::string                     cache_path;     // Empty when the code cache is disabled.
+};
+
+v8_script_t *v8_script_compile(const char *source_code)
+{
+    return (v8_script_compile_flags(source_code, V8_COMPILE_DEFAULT));
+}
+
+v8_script_t *v8_script_compile_flags(const char *source_code, int flags)
+{
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+    v8::HandleScope handle_scope(isolate);
 
     // Create a string containing the JavaScript source code.
-    v8::MaybeLocal<v8::String> maybe_source = v8::String::NewFromUtf8(isolate, source_code);
+    v8::Local<v8::String> source_string;
 
-    if (maybe_source.IsEmpty()) {
+    if (!v8::String::NewFromUtf8(isolate, source_code).ToLocal(&source_string)) {
         return (nullptr);
     }
 
-    // Compile the source code and detect errors.
-    v8::MaybeLocal<v8::Script> maybe_script = v8::Script::Compile(context, maybe_source.ToLocalChecked());
+    // Compile the source code once, independently of any context.
+    v8::Local<v8::UnboundScript> unbound;
 
-    if (maybe_script.IsEmpty()) {
+    if (!v8impl::CompileUnbound(isolate, source_string, source_code, strlen(source_code), flags).ToLocal(&unbound)) {
         return (nullptr);
     }
 
-    // Run the script.
-    v8::Local<v8::Value> result_def = static_cast<v8::Local<v8::Value>>(v8::Undefined(isolate));
-    v8::Local<v8::Value> result     = maybe_script.ToLocalChecked()->Run(context).FromMaybe(result_def);
+    v8_script_t *script = new v8_script_t();
+    script->isolate     = isolate;
+    script->handle.Reset(isolate, unbound);
+
+    if (!v8impl::instance->code_cache_path.empty())
+        script->cache_path = v8impl::CodeCachePath(v8impl::CodeCacheKind(flags), source_code, strlen(source_code));
 
-    // Return result.
-    return (v8impl::ValueFromV8(result));
+    return (script);
+}
+
+v8_value_t v8_script_exec(v8_script_t *script, v8_context_t *context)
+{
+    v8::Isolate *isolate = script->isolate;
+
+    // Run in the given context, or the current one.
+    v8::Local<v8::Context> target = (context != nullptr)
+        ? context->handle.Get(isolate)
+        : isolate->GetCurrentContext();
+
+    v8::Context::Scope context_scope(target);
+
+    // Bind the compiled code to the context, no parsing involved.
+    v8::Local<v8::Script> bound = script->handle.Get(isolate)->BindToCurrentContext();
+
+    return (v8impl::ValueFromV8(v8impl::ScriptRun(isolate, target, bound)));
+}
+
+void v8_script_dispose(v8_script_t *script)
+{
+    script->handle.Reset();
+    delete (script);
+}
+
+void v8_script_update_code_cache(v8_script_t *script)
+{
+    if (script->cache_path.empty())
+        return;
+
+    v8::HandleScope handle_scope(script->isolate);
+
+    // Functions compiled since, e.g. while warming up, are included in the new entry.
+    v8impl::CodeCacheStore(script->cache_path, v8::ScriptCompiler::CreateCodeCache(script->handle.Get(script->isolate)));
+}
+
+void v8_script_cache_stats(v8_isolate_t *isolate, v8_script_cache_stats_t *stats)
+{
+    *stats          = isolate->script_cache.stats;
+    stats->count    = isolate->script_cache.entries.size();
+    stats->bytes    = isolate->script_cache.bytes;
+}
+
+void v8_warmup(const v8_warmup_call_t *calls, size_t count, size_t iterations)
+{
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+    // Replay recorded inputs so that hot functions tier up before real traffic.
+    for (size_t i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < count; j++) {
+            v8::HandleScope handle_scope(isolate);
+            v8_call_function(calls[j].func, calls[j].args, calls[j].argc);
+        }
+    }
+}
+
+void v8_code_cache_stats(v8_code_cache_stats_t *stats)
+{
+    stats->hits     = v8impl::code_cache_hits;
+    stats->misses   = v8impl::code_cache_misses;
+    stats->rejects  = v8impl::code_cache_rejects;
+}
+
+
+///////////////////////////////////
+//  STREAMING
+///////////////////////////////////
+
+
+namespace v8impl
+{
+    // Chunks pushed by the host, pulled by the streaming task on a worker thread.
+    class ChunkStream : public v8::ScriptCompiler::ExternalSourceStream
+    {
+        public:
+            size_t GetMoreData(const uint8_t **src) override
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+
+                while (chunks_.empty() && !ended_)
+                    cond_.wait(lock);
+
+                // End of the source.
+                if (chunks_.empty())
+                    return (0);
+
+                // V8 takes ownership of the chunk.
+                std::pair<uint8_t*, size_t> chunk = chunks_.front();
+                chunks_.pop_front();
+
+                *src = chunk.first;
+                return (chunk.second);
+            }
+
+            void Push(const char *data, size_t length)
+            {
+                uint8_t *chunk = new uint8_t[length];
+                memcpy(chunk, data, length);
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                chunks_.emplace_back(chunk, length);
+                cond_.notify_one();
+            }
+
+            void End()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ended_ = true;
+                cond_.notify_one();
+            }
+
+            ~ChunkStream()
+            {
+                for (auto &chunk : chunks_)
+                    delete[] (chunk.first);
+            }
+
+        private:
+            std::mutex                                  mutex_;
+            std::condition_variable                     cond_;
+            std::deque<std::pair<uint8_t*, size_t>>     chunks_;
+            bool                                        ended_ = false;
+    };
+};
+
+struct v8_stream_t
+{
+    v8::Isolate                                             *isolate;
+    std::string                                             name;
+    std::string                                             source;     // Full source, needed to finalize.
+    v8impl::ChunkStream                                     *chunks;    // Owned by the streamed source.
+    std::unique_ptr<v8::ScriptCompiler::StreamedSource>     streamed;
+    std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task;
+    std::mutex                                              mutex;
+    std::condition_variable                                 cond;
+    bool                                                    done;
+    bool                                                    failed;     // The source could not be read.
+};
+
+namespace v8impl
+{
+    // Parse and compile the streamed source on a worker thread.
+    class StreamTask : public v8::Task
+    {
+        public:
+            StreamTask(v8_stream_t *stream) : stream_(stream) {}
+
+            void Run() override
+            {
+                stream_->task->Run();
+
+                std::lock_guard<std::mutex> lock(stream_->mutex);
+                stream_->done = true;
+                stream_->cond.notify_all();
+            }
+
+        private:
+            v8_stream_t *stream_;
+    };
+};
+
+namespace v8impl
+{
+    v8_stream_t *StreamNew(const char *name)
+    {
+        v8_stream_t *stream = new v8_stream_t();
+        stream->isolate     = v8::Isolate::GetCurrent();
+        stream->name        = name ? name : "";
+        stream->chunks      = new ChunkStream();
+        stream->done        = false;
+        stream->failed      = false;
+
+        // The streaming task must be created on the isolate thread.
+        stream->streamed    = std::make_unique<v8::ScriptCompiler::StreamedSource>(
+            std::unique_ptr<v8::ScriptCompiler::ExternalSourceStream>(stream->chunks),
+            v8::ScriptCompiler::StreamedSource::UTF8
+        );
+        stream->task.reset(v8::ScriptCompiler::StartStreaming(stream->isolate, stream->streamed.get()));
+
+        return (stream);
+    }
+
+    // Read a whole file then parse it, on the same worker thread.
+    class FileStreamTask : public v8::Task
+    {
+        public:
+            FileStreamTask(v8_stream_t *stream) : stream_(stream) {}
+
+            void Run() override
+            {
+                char buf[64 * 1024];
+                ssize_t len;
+                int fd = open(stream_->name.c_str(), O_RDONLY);
+
+                // The stream is ended before parsing, the worker never waits for data.
+                if (fd != -1) {
+                    while ((len = read(fd, buf, sizeof(buf))) > 0)
+                        v8_script_stream_write(stream_, buf, len);
+
+                    stream_->failed = (len < 0);
+                    close(fd);
+                } else {
+                    stream_->failed = true;
+                }
+
+                // Still parse so V8 releases the task, the result is dropped on failure.
+                stream_->chunks->End();
+                StreamTask(stream_).Run();
+            }
+
+        private:
+            v8_stream_t *stream_;
+    };
+};
+
+v8_stream_t *v8_script_stream_start(const char *name)
+{
+    v8_stream_t *stream = v8impl::StreamNew(name);
+
+    // Start parsing on a worker while the source is still being read.
+    v8impl::instance->platform->CallOnWorkerThread(std::make_unique<v8impl::StreamTask>(stream));
+    return (stream);
+}
+
+void v8_script_stream_write(v8_stream_t *stream, const char *data, size_t length)
+{
+    stream->source.append(data, length);
+    stream->chunks->Push(data, length);
+}
+
+v8_script_t *v8_script_stream_finish(v8_stream_t *stream)
+{
+    v8::Isolate *isolate = stream->isolate;
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+
+    // Wait for the worker to consume the whole source.
+    stream->chunks->End();
+
+    {
+        std::unique_lock<std::mutex> lock(stream->mutex);
+
+        while (!stream->done)
+            stream->cond.wait(lock);
+    }
+
+    // Finalize on the isolate thread.
+    v8::Local<v8::String> source_string;
+    v8::Local<v8::Script> compiled;
+    v8_script_t *script = nullptr;
+
+    if (!stream->failed && v8::String::NewFromUtf8(isolate, stream->source.data(), v8::NewStringType::kNormal, stream->source.size()).ToLocal(&source_string)) {
+        v8::ScriptOrigin origin(isolate, v8::String::NewFromUtf8(isolate, stream->name.c_str()).ToLocalChecked());
+
+        if (v8::ScriptCompiler::Compile(context, stream->streamed.get(), source_string, origin).ToLocal(&compiled)) {
+            script          = new v8_script_t();
+            script->isolate = isolate;
+            script->handle.Reset(isolate, compiled->GetUnboundScript());
+        }
+    }
+
+    delete (stream);
+    return (script);
+}
+
+v8_script_t *v8_script_compile_file(const char *path)
+{
+    char buf[64 * 1024];
+    ssize_t len;
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+        return (nullptr);
+
+    // Feed the worker while reading the file.
+    v8_stream_t *stream = v8_script_stream_start(path);
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+        v8_script_stream_write(stream, buf, len);
+
+    stream->failed = (len < 0);
+    close(fd);
+    return (v8_script_stream_finish(stream));
+}
+
+size_t v8_script_compile_files(const char **paths, size_t count, v8_script_t **scripts)
+{
+    std::vector<v8_stream_t*> streams;
+    size_t compiled = 0;
+
+    // Read and parse every file in parallel on the platform workers.
+    for (size_t i = 0; i < count; i++) {
+        streams.push_back(v8impl::StreamNew(paths[i]));
+        v8impl::instance->platform->CallOnWorkerThread(std::make_unique<v8impl::FileStreamTask>(streams[i]));
+    }
+
+    // Finalize in the given order.
+    for (size_t i = 0; i < count; i++) {
+        scripts[i] = v8_script_stream_finish(streams[i]);
+
+        if (scripts[i] != nullptr)
+            compiled++;
+    }
+
+    return (compiled);
+}
+
+
+///////////////////////////////////
+//  EXTERNAL SOURCES
+///////////////////////////////////
+
+
+namespace v8impl
+{
+    // ASCII source mapped in memory, unmapped when V8 collects the string.
+    class MappedSource : public v8::String::ExternalOneByteStringResource
+    {
+        public:
+            MappedSource(const char *data, size_t length) : data_(data), length_(length) {}
+            ~MappedSource() { munmap(const_cast<char*>(data_), length_); }
+
+            const char *data() const override { return (data_); }
+            size_t length() const override { return (length_); }
+
+        private:
+            const char  *data_;
+            size_t      length_;
+    };
+
+    // Non ASCII source decoded off the JavaScript heap.
+    class TwoByteSource : public v8::String::ExternalStringResource
+    {
+        public:
+            TwoByteSource(std::vector<uint16_t> &&data) : data_(std::move(data)) {}
+
+            const uint16_t *data() const override { return (data_.data()); }
+            size_t length() const override { return (data_.size()); }
+
+        private:
+            std::vector<uint16_t> data_;
+    };
+
+    bool IsAscii(const char *data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++) {
+            if (static_cast<uint8_t>(data[i]) & 0x80)
+                return (false);
+        }
+
+        return (true);
+    }
+
+    // Decode UTF-8 to UTF-16, invalid sequences become U+FFFD.
+    std::vector<uint16_t> Utf8ToUtf16(const char *data, size_t length)
+    {
+        std::vector<uint16_t> out;
+        const uint8_t *s = reinterpret_cast<const uint8_t*>(data);
+        size_t i = 0;
+
+        out.reserve(length);
+
+        while (i < length) {
+            uint32_t c  = s[i];
+            size_t n    = (c < 0x80) ? 0 : (c >> 5) == 0x6 ? 1 : (c >> 4) == 0xe ? 2 : (c >> 3) == 0x1e ? 3 : 4;
+
+            if (n == 4 || i + n >= length) {
+                out.push_back(0xfffd);
+                i++;
+                continue;
+            }
+
+            // Gather continuation bytes.
+            c &= (n == 0) ? 0x7f : (0x3f >> n);
+
+            size_t k = 1;
+            for (; k <= n && (s[i + k] & 0xc0) == 0x80; k++)
+                c = (c << 6) | (s[i + k] & 0x3f);
+
+            if (k <= n || c > 0x10ffff) {
+                out.push_back(0xfffd);
+                i += k;
+                continue;
+            }
+
+            // Surrogate pairs above the BMP.
+            if (c >= 0x10000) {
+                c -= 0x10000;
+                out.push_back(0xd800 | (c >> 10));
+                out.push_back(0xdc00 | (c & 0x3ff));
+            } else {
+                out.push_back(c);
+            }
+
+            i += n + 1;
+        }
+
+        return (out);
+    }
+};
+
+v8_value_t v8_script_run_external(const char *path)
+{
+    v8::Isolate *isolate            = v8::Isolate::GetCurrent();
+    v8::Local<v8::Context> context  = isolate->GetCurrentContext();
+    const char *data;
+    size_t length;
+
+    // Map the source, it never gets copied into the JavaScript heap.
+    if (!v8impl::MapFile(path, &data, &length)) {
+        return (nullptr);
+    }
+
+    v8::Local<v8::String> source_string;
+    bool ascii = v8impl::IsAscii(data, length);
+
+    if (ascii) {
+        auto resource = new v8impl::MappedSource(data, length);
+
+        if (!v8::String::NewExternalOneByte(isolate, resource).ToLocal(&source_string)) {
+            delete (resource);
+            return (nullptr);
+        }
+    } else {
+        auto resource = new v8impl::TwoByteSource(v8impl::Utf8ToUtf16(data, length));
+
+        if (!v8::String::NewExternalTwoByte(isolate, resource).ToLocal(&source_string))
+            delete (resource);
+    }
+
+    // Compile, the mapping is still used to key the code cache.
+    v8::Local<v8::UnboundScript> unbound;
+    bool compiled = !source_string.IsEmpty()
+        && v8impl::CompileUnbound(isolate, source_string, data, length).ToLocal(&unbound);
+
+    // The two-byte source is a decoded copy, the mapping is not needed anymore.
+    if (!ascii)
+        munmap(const_cast<char*>(data), length);
+
+    if (!compiled) {
+        return (nullptr);
+    }
+
+    // Run the script and return result.
+    v8::Local<v8::Script> script = unbound->BindToCurrentContext();
+    return (v8impl::ValueFromV8(v8impl::ScriptRun(isolate, context, script)));
+}
+
+
+///////////////////////////////////
+//  MODULES
+///////////////////////////////////
+
+
+namespace v8impl
+{
+    // Compile a module, going through the on-disk code cache when enabled.
+    v8::MaybeLocal<v8::Module> CompileModule(v8::Isolate *isolate, v8::Local<v8::String> name, const char *source_code, size_t length)
+    {
+        v8::Local<v8::String> source_string;
+
+        if (!v8::String::NewFromUtf8(isolate, source_code, v8::NewStringType::kNormal, length).ToLocal(&source_string))
+            return (v8::MaybeLocal<v8::Module>());
+
+        v8::ScriptOrigin origin(isolate, name, 0, 0, false, -1, v8::Local<v8::Value>(), false, false, true);
+
+        if (instance->code_cache_path.empty()) {
+            v8::ScriptCompiler::Source source(source_string, origin);
+            return (v8::ScriptCompiler::CompileModule(isolate, &source));
+        }
+
+        return (CodeCacheCompile<v8::Module>(
+            isolate, CodeCachePath("module", source_code, length), v8::ScriptCompiler::kNoCompileOptions,
+            [&](v8::ScriptCompiler::CachedData *cached_data, v8::ScriptCompiler::CompileOptions options, bool *rejected) {
+                v8::ScriptCompiler::Source source(source_string, origin, cached_data);
+                v8::MaybeLocal<v8::Module> module = v8::ScriptCompiler::CompileModule(isolate, &source, options);
+
+                *rejected = cached_data != nullptr && source.GetCachedData()->rejected;
+                return (module);
+            },
+            [](v8::Local<v8::Module> module) {
+                return (v8::ScriptCompiler::CreateCodeCache(module->GetUnboundModuleScript()));
+            }
+        ));
+    }
+
+    // Resolve a specifier through the host and get its module, compiled once per context.
+    v8::MaybeLocal<v8::Module> ModuleGet(v8::Isolate *isolate, const char *specifier, const char *referrer)
+    {
+        v8_isolate_t *state     = static_cast<v8_isolate_t*>(isolate->GetData(0));
+        v8_context_t *context   = ContextFromV8(isolate->GetCurrentContext());
+        char name[4096]         = { 0 };
+
+        if (state->module_resolve_cb == nullptr) {
+            isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8Literal(isolate, "No module resolver")));
+            return (v8::MaybeLocal<v8::Module>());
+        }
+
+        if (context == nullptr) {
+            isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8Literal(isolate, "Modules are not supported in this context")));
+            return (v8::MaybeLocal<v8::Module>());
+        }
+
+        // Ask the host for the resolved name and the source.
+        char *source_code = state->module_resolve_cb(specifier, referrer, name, sizeof(name), state->module_resolve_data);
+        name[sizeof(name) - 1] = 0;
+
+        // The resolved name keys the module map, it cannot be empty.
+        if (name[0] == 0) {
+            free(source_code);
+
+            std::string message = std::string("Cannot resolve module '") + specifier + "'";
+            isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(isolate, message.c_str()).ToLocalChecked()));
+            return (v8::MaybeLocal<v8::Module>());
+        }
+
+        // Already in the module map.
+        auto it = context->modules.find(name);
+
+        if (it != context->modules.end()) {
+            free(source_code);
+            return (it->second.Get(isolate));
+        }
+
+        if (source_code == nullptr) {
+            std::string message = std::string("Cannot find module '") + specifier + "'";
+            isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(isolate, message.c_str()).ToLocalChecked()));
+            return (v8::MaybeLocal<v8::Module>());
+        }
+
+        v8::Local<v8::String> module_name   = v8::String::NewFromUtf8(isolate, name).ToLocalChecked();
+        v8::MaybeLocal<v8::Module> module   = CompileModule(isolate, module_name, source_code, strlen(source_code));
+        free(source_code);
+
+        if (module.IsEmpty())
+            return (module);
+
+        // Register the module so that it is compiled once.
+        context->modules[name].Reset(isolate, module.ToLocalChecked());
+        context->module_names.emplace(module.ToLocalChecked()->GetIdentityHash(), name);
+
+        return (module);
+    }
+
+    v8::MaybeLocal<v8::Module> ModuleResolve(v8::Local<v8::Context> context, v8::Local<v8::String> specifier, v8::Local<v8::FixedArray> import_assertions, v8::Local<v8::Module> referrer)
+    {
+        v8::Isolate *isolate    = context->GetIsolate();
+        v8_context_t *state     = ContextFromV8(context);
+        std::string referrer_name;
+
+        if (state == nullptr) {
+            isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8Literal(isolate, "Modules are not supported in this context")));
+            return (v8::MaybeLocal<v8::Module>());
+        }
+
+        // Find the name of the referrer, identity hashes may collide.
+        auto range = state->module_names.equal_range(referrer->GetIdentityHash());
+
+        for (auto it = range.first; it != range.second; it++) {
+            if (state->modules[it->second] == referrer) {
+                referrer_name = it->second;
+                break;
+            }
+        }
+
+        v8::String::Utf8Value specifier_utf8(isolate, specifier);
+        return (ModuleGet(isolate, *specifier_utf8, referrer_name.c_str()));
+    }
+};
+
+void v8_module_set_resolver(v8_module_resolve_cb_t cb, void *data)
+{
+    v8_isolate_t *state         = static_cast<v8_isolate_t*>(v8::Isolate::GetCurrent()->GetData(0));
+    state->module_resolve_cb    = cb;
+    state->module_resolve_data  = data;
+}
+
+v8_value_t v8_module_load(const char *specifier)
+{
+    v8::Isolate *isolate            = v8::Isolate::GetCurrent();
+    v8::Local<v8::Context> context  = isolate->GetCurrentContext();
+    v8::Local<v8::Module> module;
+
+    // Get the module and its dependencies.
+    if (!v8impl::ModuleGet(isolate, specifier, nullptr).ToLocal(&module)) {
+        return (nullptr);
+    }
+
+    if (module->GetStatus() == v8::Module::kUninstantiated) {
+        if (!module->InstantiateModule(context, v8impl::ModuleResolve).FromMaybe(false)) {
+            return (nullptr);
+        }
+    }
+
+    // Evaluate once, the heap limit policy may terminate it.
+    if (module->GetStatus() == v8::Module::kInstantiated) {
+        v8::Isolate::SafeForTerminationScope termination_scope(isolate);
+        bool evaluated;
+
+        {
+            v8impl::CallScope call_scope(isolate);
+            evaluated = !module->Evaluate(context).IsEmpty();
+        }
+
+        if (!evaluated) {
+            return (nullptr);
+        }
+
+        v8impl::IsolateAutoPump(isolate);
+    }
+
+    if (module->GetStatus() == v8::Module::kErrored) {
+        return (nullptr);
+    }
+
+    return (v8impl::ValueFromV8(module->GetModuleNamespace()));
+}
+
+
+///////////////////////////////////
+//  WASM
+///////////////////////////////////
+
+
+struct v8_wasm_stream_t
+{
+    v8::Isolate                             *isolate;
+    std::shared_ptr<v8::WasmStreaming>      streaming;
+    v8::Global<v8::Promise>                 promise;
+    std::string                             cache_path;     // Empty when not cached.
+    v8::ScriptCompiler::CachedData          *cached_data;   // Must outlive Finish.
+    bool                                    abandoned;      // Start gave up, the callback frees the stream.
+};
+
+namespace v8impl
+{
+    // Store the compiled module of a stream, native code is not compiled again on the next start.
+    class WasmCacheClient : public v8::WasmStreaming::Client
+    {
+        public:
+            WasmCacheClient(const std::string &path) : path_(path) {}
+
+            void OnModuleCompiled(v8::CompiledWasmModule compiled_module) override
+            {
+                v8::OwnedBuffer buffer = compiled_module.Serialize();
+
+                if (buffer.size > 0)
+                    CodeCacheStore(path_, new v8::ScriptCompiler::CachedData(buffer.buffer.get(), buffer.size));
+            }
+
+        private:
+            std::string path_;
+    };
+
+    // Called by WebAssembly.compileStreaming with the stream given by v8_wasm_stream_start.
+    void WasmStreamingCallback(const v8::FunctionCallbackInfo<v8::Value> &args)
+    {
+        v8::Isolate *isolate                        = args.GetIsolate();
+        std::shared_ptr<v8::WasmStreaming> streaming = v8::WasmStreaming::Unpack(isolate, args.Data());
+
+        // Scripts may call compileStreaming themselves, only streams from v8_wasm_stream_start are supported.
+        if (!args[0]->IsExternal()) {
+            streaming->Abort(v8::Exception::TypeError(v8::String::NewFromUtf8Literal(isolate, "WebAssembly streaming is not supported")));
+            return;
+        }
+
+        v8_wasm_stream_t *stream = static_cast<v8_wasm_stream_t*>(args[0].As<v8::External>()->Value());
+
+        if (stream->abandoned) {
+            streaming->Abort(v8::MaybeLocal<v8::Value>());
+            delete (stream);
+            return;
+        }
+
+        stream->streaming = streaming;
+
+        if (stream->cache_path.empty())
+            return;
+
+        // Use the cached native module, or store it once compiled.
+        stream->cached_data = CodeCacheLoad(stream->cache_path);
+
+        if (stream->cached_data != nullptr && stream->streaming->SetCompiledModuleBytes(stream->cached_data->data, stream->cached_data->length)) {
+            code_cache_hits++;
+            return;
+        }
+
+        if (stream->cached_data != nullptr)
+            code_cache_rejects++;
+        else
+            code_cache_misses++;
+
+        stream->streaming->SetClient(std::make_shared<WasmCacheClient>(stream->cache_path));
+    }
+
+    v8::MaybeLocal<v8::Object> WasmNamespace(v8::Isolate *isolate, v8::Local<v8::Context> context)
+    {
+        v8::Local<v8::Value> wasm;
+
+        if (!context->Global()->Get(context, v8::String::NewFromUtf8Literal(isolate, "WebAssembly")).ToLocal(&wasm) || !wasm->IsObject())
+            return (v8::MaybeLocal<v8::Object>());
+
+        return (wasm.As<v8::Object>());
+    }
+};
+
+v8_wasm_stream_t *v8_wasm_stream_start(const char *cache_key, size_t length)
+{
+    v8::Isolate *isolate            = v8::Isolate::GetCurrent();
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context  = isolate->GetCurrentContext();
+    v8::Local<v8::Object> wasm;
+    v8::Local<v8::Value> compile;
+    v8::Local<v8::Value> promise;
+
+    // Microtasks run by the checkpoint below are JavaScript too.
+    v8impl::CallScope call_scope(isolate);
+
+    v8_wasm_stream_t *stream    = new v8_wasm_stream_t();
+    stream->isolate             = isolate;
+    stream->cached_data         = nullptr;
+    stream->abandoned           = false;
+
+    if (cache_key != nullptr && !v8impl::instance->code_cache_path.empty())
+        stream->cache_path = v8impl::CodeCachePath("wasm", cache_key, length);
+
+    // Let V8 call back with the streaming object.
+    v8::Local<v8::Value> arg = v8::External::New(isolate, stream);
+
+    if (!v8impl::WasmNamespace(isolate, context).ToLocal(&wasm)
+        || !wasm->Get(context, v8::String::NewFromUtf8Literal(isolate, "compileStreaming")).ToLocal(&compile)
+        || !compile->IsFunction()
+        || !compile.As<v8::Function>()->Call(context, wasm, 1, &arg).ToLocal(&promise)) {
+        delete (stream);
+        return (nullptr);
+    }
+
+    // The callback is a promise reaction, it only ran already when called from outside JavaScript.
+    if (stream->streaming == nullptr)
+        isolate->PerformMicrotaskCheckpoint();
+
+    // Still pending inside a microtask, the reaction holds the stream and aborts it once it runs.
+    if (stream->streaming == nullptr) {
+        stream->abandoned = true;
+        return (nullptr);
+    }
+
+    stream->promise.Reset(isolate, promise.As<v8::Promise>());
+    return (stream);
+}
+
+void v8_wasm_stream_write(v8_wasm_stream_t *stream, const uint8_t *bytes, size_t length)
+{
+    stream->streaming->OnBytesReceived(bytes, length);
+}
+
+v8_value_t v8_wasm_stream_finish(v8_wasm_stream_t *stream)
+{
+    v8::Isolate *isolate        = stream->isolate;
+    v8::EscapableHandleScope handle_scope(isolate);
+    v8::Local<v8::Promise> promise = stream->promise.Get(isolate);
+
+    stream->streaming->Finish();
+
+    // Inside JavaScript the tasks settling the promise must not run, it is returned pending.
+    bool nested = v8impl::IsolateInCall(isolate);
+    v8impl::CallScope call_scope(isolate);
+
+    // Run the tasks settling the promise.
+    while (!nested) {
+        isolate->PerformMicrotaskCheckpoint();
+
+        if (promise->State() != v8::Promise::kPending)
+            break;
+
+        v8::platform::PumpMessageLoop(v8impl::instance->platform.get(), isolate, v8::platform::MessageLoopBehavior::kWaitForWork);
+    }
+
+    stream->promise.Reset();
+    delete (stream->cached_data);
+    delete (stream);
+
+    if (nested) {
+        return (v8impl::ValueFromV8(handle_scope.Escape(promise)));
+    }
+
+    if (promise->State() != v8::Promise::kFulfilled) {
+        return (nullptr);
+    }
+
+    return (v8impl::ValueFromV8(handle_scope.Escape(promise->Result())));
+}
+
+v8_value_t v8_wasm_compile(const uint8_t *bytes, size_t length)
+{
+    // The wire bytes are the cache key.
+    v8_wasm_stream_t *stream = v8_wasm_stream_start(reinterpret_cast<const char*>(bytes), length);
+
+    if (stream == nullptr) {
+        return (nullptr);
+    }
+
+    v8_wasm_stream_write(stream, bytes, length);
+    return (v8_wasm_stream_finish(stream));
+}
+
+v8_value_t v8_wasm_instantiate(v8_value_t module, v8_value_t imports)
+{
+    v8::Isolate *isolate            = v8::Isolate::GetCurrent();
+    v8::EscapableHandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context  = isolate->GetCurrentContext();
+    v8::Local<v8::Object> wasm;
+    v8::Local<v8::Value> constructor;
+    v8::Local<v8::Object> instance;
+    v8::Local<v8::Value> exports;
+
+    v8::Local<v8::Value> args[2] = {
+        v8impl::V8FromValue(module),
+        imports ? v8impl::V8FromValue(imports) : v8::Undefined(isolate).As<v8::Value>()
+    };
+
+    // new WebAssembly.Instance(module, imports).exports, its start function may call host functions.
+    v8impl::CallScope call_scope(isolate);
+
+    if (!v8impl::WasmNamespace(isolate, context).ToLocal(&wasm)
+        || !wasm->Get(context, v8::String::NewFromUtf8Literal(isolate, "Instance")).ToLocal(&constructor)
+        || !constructor->IsFunction()
+        || !constructor.As<v8::Function>()->NewInstance(context, 2, args).ToLocal(&instance)
+        || !instance->Get(context, v8::String::NewFromUtf8Literal(isolate, "exports")).ToLocal(&exports)) {
+        return (nullptr);
+    }
+
+    return (v8impl::ValueFromV8(handle_scope.Escape(exports)));
+}
+
+
+///////////////////////////////////
+//  ISOLATE POOL
+///////////////////////////////////
+
+
+struct v8_isolate_pool_t
+{
+    std::mutex                  mutex;
+    std::condition_variable     cond;
+    std::vector<v8_isolate_t*>  idle;
+    size_t                      min_size;
+    size_t                      max_size;
+    v8_isolate_params_t         params;
+    size_t                      count;      // Isolates owned by the pool, idle or not.
+    size_t                      pending;    // Isolates being prepared on worker threads.
+};
+
+namespace v8impl
+{
+    // Prepare an isolate on a platform worker thread and hand it to the pool.
+    class PoolTask : public v8::Task
+    {
+        public:
+            PoolTask(v8_isolate_pool_t *pool, v8_isolate_t *isolate) : pool_(pool), isolate_(isolate) {}
+
+            void Run() override
+            {
+                // Create a new isolate, or clear the state left by its previous user.
+                if (isolate_ == nullptr)
+                    isolate_ = IsolateNew(&pool_->params);
+                else
+                    IsolateRecycle(isolate_);
+
+                IsolateResetContext(isolate_);
+
+                // Give the isolate back to the pool.
+                std::lock_guard<std::mutex> lock(pool_->mutex);
+
+                pool_->idle.push_back(isolate_);
+                pool_->pending--;
+                pool_->cond.notify_all();
+            }
+
+        private:
+            v8_isolate_pool_t   *pool_;
+            v8_isolate_t        *isolate_;
+    };
+
+    // Must be called with the pool mutex held.
+    void PoolPost(v8_isolate_pool_t *pool, v8_isolate_t *isolate)
+    {
+        pool->pending++;
+        instance->platform->CallOnWorkerThread(std::make_unique<PoolTask>(pool, isolate));
+    }
+
+    // Must be called with the pool mutex held.
+    void PoolRefill(v8_isolate_pool_t *pool)
+    {
+        while (pool->idle.size() + pool->pending < pool->min_size && pool->count < pool->max_size) {
+            pool->count++;
+            PoolPost(pool, nullptr);
+        }
+    }
+};
+
+v8_isolate_pool_t *v8_isolate_pool_new(size_t min_size, size_t max_size)
+{
+    return (v8_isolate_pool_new_params(min_size, max_size, nullptr));
+}
+
+v8_isolate_pool_t *v8_isolate_pool_new_params(size_t min_size, size_t max_size, const v8_isolate_params_t *params)
+{
+    // A pool that may never own an isolate would block acquire forever.
+    if ((min_size == 0 && max_size == 0) || !v8impl::IsolateParamsValid(params))
+        return (nullptr);
+
+    v8_isolate_pool_t *pool = new v8_isolate_pool_t();
+
+    if (params != nullptr)
+        pool->params = *params;
+
+    pool->min_size  = min_size;
+    pool->max_size  = (max_size < min_size) ? min_size : max_size;
+    pool->count     = 0;
+    pool->pending   = 0;
+
+    // Warm up the pool in background.
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    v8impl::PoolRefill(pool);
+
+    return (pool);
+}
+
+v8_isolate_t *v8_isolate_pool_acquire(v8_isolate_pool_t *pool)
+{
+    std::unique_lock<std::mutex> lock(pool->mutex);
+
+    while (pool->idle.empty()) {
+        // Nothing ready and room left, create one on the calling thread.
+        if (pool->count < pool->max_size && pool->pending == 0) {
+            pool->count++;
+            lock.unlock();
+
+            v8_isolate_t *isolate = v8_isolate_new_params(&pool->params);
+
+            lock.lock();
+            v8impl::PoolRefill(pool);
+            return (isolate);
+        }
+
+        // Wait for an isolate to be prepared or released.
+        pool->cond.wait(lock);
+    }
+
+    v8_isolate_t *isolate = pool->idle.back();
+    pool->idle.pop_back();
+
+    // Keep enough isolates ready for the next bursts.
+    v8impl::PoolRefill(pool);
+    return (isolate);
+}
+
+void v8_isolate_pool_release(v8_isolate_pool_t *pool, v8_isolate_t *isolate)
+{
+    std::lock_guard<std::mutex> lock(pool->mutex);
+
+    // Reset the context in background before the isolate is handed out again.
+    v8impl::PoolPost(pool, isolate);
+}
+
+void v8_isolate_pool_dispose(v8_isolate_pool_t *pool)
+{
+    std::unique_lock<std::mutex> lock(pool->mutex);
+
+    // Wait for background tasks to finish.
+    while (pool->pending > 0)
+        pool->cond.wait(lock);
+
+    for (v8_isolate_t *isolate : pool->idle)
+        v8impl::IsolateDispose(isolate);
+
+    lock.unlock();
+    delete (pool);
+}
+
+
+///////////////////////////////////
+//  CONTEXT POOL
+///////////////////////////////////
+
+
+struct v8_context_pool_t
+{
+    std::vector<v8_context_t*>  idle;
+    size_t                      size;
+};
+
+v8_context_pool_t *v8_context_pool_new(size_t size)
+{
+    v8_context_pool_t *pool = new v8_context_pool_t();
+    pool->size              = size;
+
+    // Create contexts ahead of time.
+    v8_context_pool_refill(pool);
+
+    return (pool);
+}
+
+v8_context_t *v8_context_pool_acquire(v8_context_pool_t *pool)
+{
+    // Pool exhausted, create one on demand.
+    if (pool->idle.empty())
+        return (v8_context_new());
+
+    v8_context_t *context = pool->idle.back();
+    pool->idle.pop_back();
+
+    return (context);
+}
+
+void v8_context_pool_release(v8_context_pool_t *pool, v8_context_t *context)
+{
+    // A used context is never handed out again, its globals and builtins may have been changed by scripts.
+    v8_context_dispose(context);
+}
+
+void v8_context_pool_refill(v8_context_pool_t *pool)
+{
+    while (pool->idle.size() < pool->size)
+        pool->idle.push_back(v8_context_new());
+}
+
+void v8_context_pool_dispose(v8_context_pool_t *pool)
+{
+    for (v8_context_t *context : pool->idle)
+        v8_context_dispose(context);
+
+    delete (pool);
+}
+
+
+///////////////////////////////////
+//  SCHEDULER
+///////////////////////////////////
+
+
+namespace v8impl
+{
+    struct SchedulerTask
+    {
+        v8_task_cb_t    cb;
+        void            *data;
+    };
+
+    // Isolate owned by a shard, guarded by the mutex of its shard.
+    struct SchedulerEntry
+    {
+        v8_isolate_t                *isolate;
+        std::deque<SchedulerTask>   tasks;
+        std::atomic<size_t>         shard;
+        bool                        queued;     // In the run queue of its shard.
+        bool                        running;
+        bool                        removed;
+        bool                        released;   // Removed by one of its own tasks, deleted by its shard.
+        std::thread::id             runner;     // Thread running the tasks, when running.
+    };
+
+    struct Shard
+    {
+        std::mutex                      mutex;
+        std::condition_variable         cond;
+        std::condition_variable         idle;
+        std::deque<SchedulerEntry*>     queue;
+        std::vector<SchedulerEntry*>    entries;
+        std::atomic<size_t>             queue_depth;
+        std::atomic<uint64_t>           tasks_run;
+        std::atomic<uint64_t>           busy_time;
+        std::atomic<uint64_t>           steals;
+        std::thread                     thread;
+        int                             cpu;
+    };
+};
+
+struct v8_scheduler_t
+{
+    std::vector<std::unique_ptr<v8impl::Shard>>     shards;
+    std::chrono::steady_clock::time_point           start;
+    std::atomic<bool>                               stopping;
+};
+
+namespace v8impl
+{
+    inline uint64_t MicrosecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Lock two shards in a consistent order.
+    inline void ShardLockPair(Shard *a, Shard *b, std::unique_lock<std::mutex> &la, std::unique_lock<std::mutex> &lb)
+    {
+        if (a < b) {
+            la = std::unique_lock<std::mutex>(a->mutex);
+            lb = std::unique_lock<std::mutex>(b->mutex);
+        } else {
+            lb = std::unique_lock<std::mutex>(b->mutex);
+            la = std::unique_lock<std::mutex>(a->mutex);
+        }
+    }
+
+    // Move a queued isolate from the busiest shard to an idle one.
+    bool ShardSteal(v8_scheduler_t *scheduler, size_t index)
+    {
+        Shard *shard    = scheduler->shards[index].get();
+        size_t victim   = index;
+        size_t depth    = 1;
+
+        // Find the deepest run queue, one pending isolate is not worth moving.
+        for (size_t i = 0; i < scheduler->shards.size(); i++) {
+            if (scheduler->shards[i]->queue_depth > depth) {
+                depth   = scheduler->shards[i]->queue_depth;
+                victim  = i;
+            }
+        }
+
+        if (victim == index)
+            return (false);
+
+        Shard *from = scheduler->shards[victim].get();
+        std::unique_lock<std::mutex> lock_to, lock_from;
+        ShardLockPair(shard, from, lock_to, lock_from);
+
+        if (from->queue.size() < 2)
+            return (false);
+
+        // Take the last queued isolate, it would have waited the longest.
+        SchedulerEntry *entry = from->queue.back();
+        from->queue.pop_back();
+        from->queue_depth = from->queue.size();
+        from->entries.erase(std::find(from->entries.begin(), from->entries.end(), entry));
+
+        entry->shard = index;
+        shard->entries.push_back(entry);
+        shard->queue.push_back(entry);
+        shard->queue_depth = shard->queue.size();
+        shard->steals++;
+
+        return (true);
+    }
+
+    void ShardRun(v8_scheduler_t *scheduler, size_t index)
+    {
+        Shard *shard = scheduler->shards[index].get();
+
+        // Pin the thread to its core.
+        if (shard->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(shard->cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        while (true) {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+
+            // Wait for work, steal from other shards when idle.
+            while (shard->queue.empty()) {
+                if (scheduler->stopping)
+                    return;
+
+                lock.unlock();
+                bool stolen = ShardSteal(scheduler, index);
+                lock.lock();
+
+                if (!stolen && shard->queue.empty() && !scheduler->stopping)
+                    shard->cond.wait_for(lock, std::chrono::milliseconds(10));
+            }
+
+            SchedulerEntry *entry = shard->queue.front();
+            shard->queue.pop_front();
+            shard->queue_depth = shard->queue.size();
+
+            // Take the pending tasks of the isolate.
+            std::deque<SchedulerTask> tasks;
+            tasks.swap(entry->tasks);
+            entry->queued   = false;
+            entry->running  = true;
+            entry->runner   = std::this_thread::get_id();
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+
+            v8_isolate_enter(entry->isolate);
+            v8_context_enter(v8_isolate_context(entry->isolate));
+
+            // Tasks after one removing the entry are dropped, as pending ones are.
+            for (SchedulerTask &task : tasks) {
+                if (entry->released)
+                    break;
+
+                task.cb(entry->isolate, task.data);
+            }
+
+            v8_context_exit(v8_isolate_context(entry->isolate));
+            v8_isolate_exit(entry->isolate);
+
+            shard->busy_time += MicrosecondsSince(start);
+            shard->tasks_run += tasks.size();
+
+            // Queue again if tasks were posted meanwhile, on the shard now owning the isolate.
+            lock.lock();
+            entry->running = false;
+
+            if (entry->released) {
+                shard->entries.erase(std::find(shard->entries.begin(), shard->entries.end(), entry));
+                delete (entry);
+            } else if (!entry->tasks.empty() && !entry->removed) {
+                entry->queued = true;
+                shard->queue.push_back(entry);
+                shard->queue_depth = shard->queue.size();
+            }
+
+            shard->idle.notify_all();
+        }
+    }
+
+    // Lock the shard currently owning an entry.
+    Shard *SchedulerLockEntry(v8_scheduler_t *scheduler, SchedulerEntry *entry, std::unique_lock<std::mutex> &lock)
+    {
+        while (true) {
+            Shard *shard = scheduler->shards[entry->shard].get();
+            lock = std::unique_lock<std::mutex>(shard->mutex);
+
+            // The isolate may have been stolen meanwhile.
+            if (scheduler->shards[entry->shard].get() == shard)
+                return (shard);
+        }
+    }
+};
+
+v8_scheduler_t *v8_scheduler_new(size_t shards)
+{
+    v8_scheduler_t *scheduler   = new v8_scheduler_t();
+    scheduler->start            = std::chrono::steady_clock::now();
+    scheduler->stopping         = false;
+
+    // List the cores the process may run on.
+    std::vector<int> cpus;
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+
+    // One shard per core by default.
+    if (shards == 0)
+        shards = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+
+    for (size_t i = 0; i < shards; i++) {
+        auto shard          = std::make_unique<v8impl::Shard>();
+        shard->cpu          = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        shard->queue_depth  = 0;
+        shard->tasks_run    = 0;
+        shard->busy_time    = 0;
+        shard->steals       = 0;
+
+        scheduler->shards.push_back(std::move(shard));
+    }
+
+    // Start shard threads once all shards exist, they may steal from each other.
+    for (size_t i = 0; i < shards; i++)
+        scheduler->shards[i]->thread = std::thread(v8impl::ShardRun, scheduler, i);
+
+    return (scheduler);
+}
+
+v8_scheduler_entry_t *v8_scheduler_add(v8_scheduler_t *scheduler, v8_isolate_t *isolate)
+{
+    size_t index    = 0;
+    size_t load     = SIZE_MAX;
+
+    // Pick the shard with the fewest isolates.
+    for (size_t i = 0; i < scheduler->shards.size(); i++) {
+        std::lock_guard<std::mutex> lock(scheduler->shards[i]->mutex);
+
+        if (scheduler->shards[i]->entries.size() < load) {
+            load    = scheduler->shards[i]->entries.size();
+            index   = i;
+        }
+    }
+
+    auto entry      = new v8impl::SchedulerEntry();
+    entry->isolate  = isolate;
+    entry->shard    = index;
+    entry->queued   = false;
+    entry->running  = false;
+    entry->removed  = false;
+    entry->released = false;
+
+    std::lock_guard<std::mutex> lock(scheduler->shards[index]->mutex);
+    scheduler->shards[index]->entries.push_back(entry);
+
+    return (reinterpret_cast<v8_scheduler_entry_t*>(entry));
+}
+
+void v8_scheduler_post(v8_scheduler_t *scheduler, v8_scheduler_entry_t *_entry, v8_task_cb_t cb, void *data)
+{
+    auto entry = reinterpret_cast<v8impl::SchedulerEntry*>(_entry);
+    std::unique_lock<std::mutex> lock;
+    v8impl::Shard *shard = v8impl::SchedulerLockEntry(scheduler, entry, lock);
+
+    entry->tasks.push_back({ cb, data });
+
+    // Queue the isolate unless it is already waiting or running.
+    if (!entry->queued && !entry->running) {
+        entry->queued = true;
+        shard->queue.push_back(entry);
+        shard->queue_depth = shard->queue.size();
+        shard->cond.notify_one();
+    }
+}
+
+void v8_scheduler_remove(v8_scheduler_t *scheduler, v8_scheduler_entry_t *_entry)
+{
+    auto entry = reinterpret_cast<v8impl::SchedulerEntry*>(_entry);
+    std::unique_lock<std::mutex> lock;
+    v8impl::Shard *shard = v8impl::SchedulerLockEntry(scheduler, entry, lock);
+
+    // Drop pending tasks and wait for the running ones.
+    entry->removed = true;
+    entry->tasks.clear();
+
+    if (entry->queued) {
+        shard->queue.erase(std::find(shard->queue.begin(), shard->queue.end(), entry));
+        shard->queue_depth = shard->queue.size();
+    }
+
+    // Called from one of its tasks, waiting would never end, the shard deletes the entry once the task returns.
+    if (entry->running && entry->runner == std::this_thread::get_id()) {
+        entry->released = true;
+        return;
+    }
+
+    while (entry->running)
+        shard->idle.wait(lock);
+
+    shard->entries.erase(std::find(shard->entries.begin(), shard->entries.end(), entry));
+    lock.unlock();
+
+    delete (entry);
+}
+
+size_t v8_scheduler_shard_count(v8_scheduler_t *scheduler)
+{
+    return (scheduler->shards.size());
+}
+
+void v8_scheduler_stats(v8_scheduler_t *scheduler, size_t index, v8_shard_stats_t *stats)
+{
+    v8impl::Shard *shard    = scheduler->shards[index].get();
+    uint64_t elapsed        = v8impl::MicrosecondsSince(scheduler->start);
+
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats->isolates = shard->entries.size();
+    }
+
+    stats->cpu          = shard->cpu;
+    stats->queue_depth  = shard->queue_depth;
+    stats->tasks_run    = shard->tasks_run;
+    stats->busy_time    = shard->busy_time;
+    stats->steals       = shard->steals;
+    stats->utilization  = elapsed ? static_cast<double>(stats->busy_time) / elapsed : 0;
+}
+
+void v8_scheduler_dispose(v8_scheduler_t *scheduler)
+{
+    scheduler->stopping = true;
+
+    // Shards finish their run queue before stopping.
+    for (auto &shard : scheduler->shards) {
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->cond.notify_all();
+        }
+
+        shard->thread.join();
+    }
+
+    for (auto &shard : scheduler->shards) {
+        for (v8impl::SchedulerEntry *entry : shard->entries)
+            delete (entry);
+    }
+
+    delete (scheduler);
+}
+
+
+///////////////////////////////////
+//  SNAPSHOT
+///////////////////////////////////
+
+
+namespace v8impl
+{
+    // Must be identical when creating and when booting from a snapshot.
+    std::vector<intptr_t> ExternalReferences(const v8_snapshot_func_t *funcs, size_t count)
+    {
+        std::vector<intptr_t> refs;
+
+        refs.push_back(reinterpret_cast<intptr_t>(v8_callback_function));
+        refs.push_back(reinterpret_cast<intptr_t>(v8_snapshot_callback_function));
+
+        for (size_t i = 0; i < count; i++)
+            refs.push_back(reinterpret_cast<intptr_t>(funcs[i].cb));
+
+        // Null terminated.
+        refs.push_back(0);
+        return (refs);
+    }
+};
+
+v8_snapshot_t v8_snapshot_create(const char *prelude, const v8_snapshot_func_t *funcs, size_t count)
+{
+    std::vector<intptr_t> refs  = v8impl::ExternalReferences(funcs, count);
+    v8_snapshot_t snapshot      = { nullptr, 0 };
+
+    // Create a snapshot creator, it owns its own isolate.
+    v8::SnapshotCreator creator(refs.data());
+    v8::Isolate *isolate = creator.GetIsolate();
+
+    {
+        v8::Locker locker(isolate);
+        v8::HandleScope handle_scope(isolate);
+
+        // Create the context to bake in.
+        v8::Local<v8::Context> context  = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+        v8::Local<v8::Object> global    = context->Global();
+
+        // Register host functions.
+        for (size_t i = 0; i < count; i++) {
+            v8::Local<v8::Value> cb_data    = v8::External::New(isolate, reinterpret_cast<void*>(funcs[i].cb));
+            v8::Local<v8::Function> func    = v8::Function::New(context, v8_snapshot_callback_function, cb_data).ToLocalChecked();
+
+            global->Set(context, v8::String::NewFromUtf8(isolate, funcs[i].name).ToLocalChecked(), func).FromJust();
+        }
+
+        // Run the prelude script.
+        if (prelude != nullptr) {
+            v8::Local<v8::String> source;
+            v8::Local<v8::Script> script;
+
+            if (!v8::String::NewFromUtf8(isolate, prelude).ToLocal(&source)
+                || !v8::Script::Compile(context, source).ToLocal(&script)
+                || script->Run(context).IsEmpty()) {
+                return (snapshot);
+            }
+        }
+
+        creator.SetDefaultContext(context);
+    }
+
+    // Serialize the heap, keeping compiled code of the prelude.
+    v8::StartupData blob = creator.CreateBlob(v8::SnapshotCreator::FunctionCodeHandling::kKeep);
+
+    snapshot.data = blob.data;
+    snapshot.size = blob.raw_size;
+    return (snapshot);
+}
+
+void v8_snapshot_free(v8_snapshot_t snapshot)
+{
+    delete[] (snapshot.data);
 }
@@ -0,0 +1,218 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/v8c.h"
+
+
+
+///////////////////////////////////
+//  TYPES
+///////////////////////////////////
+
+
+typedef struct
+{
+    v8_isolate_t    *isolate;
+    v8_value_t      work;
+} slot_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    slot_t          *slots;
+    size_t          count;
+    size_t          next;
+    size_t          calls;
+} queue_t;
+
+
+///////////////////////////////////
+//  UTILS
+///////////////////////////////////
+
+
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+///////////////////////////////////
+//  LOCKER
+///////////////////////////////////
+
+
+#define LOCKER_ISOLATES     64
+#define LOCKER_CALLS        20000
+#define LOCKER_LOOP         10000
+
+static const char *locker_script = "(function (n) { let s = 0; for (let i = 0; i < n; i++) s += i; return s; })";
+
+void *locker_worker(queue_t *queue)
+{
+    while (1) {
+        slot_t *slot;
+
+        // Pick the next isolate, any isolate can run on any worker.
+        pthread_mutex_lock(&queue->mutex);
+
+        if (queue->calls == 0) {
+            pthread_mutex_unlock(&queue->mutex);
+            return (NULL);
+        }
+
+        slot = &queue->slots[queue->next++ % queue->count];
+        queue->calls--;
+        pthread_mutex_unlock(&queue->mutex);
+
+        // Run pending work of the isolate.
+        v8_isolate_enter(slot->isolate);
+        v8_context_enter(v8_isolate_context(slot->isolate));
+
+        v8_value_t arg = v8_create_int32(LOCKER_LOOP);
+        v8_call_function(v8_get_ref_value(slot->work), &arg, 1);
+
+        v8_context_exit(v8_isolate_context(slot->isolate));
+        v8_isolate_exit(slot->isolate);
+    }
+}
+
+void bench_locker(void)
+{
+    slot_t slots[LOCKER_ISOLATES];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Prepare isolates with the function to call.
+    for (size_t i = 0; i < LOCKER_ISOLATES; i++) {
+        slots[i].isolate = v8_isolate_new();
+
+        v8_isolate_enter(slots[i].isolate);
+        v8_context_enter(v8_isolate_context(slots[i].isolate));
+        slots[i].work = v8_create_ref(v8_script_run(locker_script));
+        v8_context_exit(v8_isolate_context(slots[i].isolate));
+        v8_isolate_exit(slots[i].isolate);
+    }
+
+    // Scale the number of workers.
+    for (long workers = 1; workers <= cores; workers *= 2) {
+        queue_t queue = { PTHREAD_MUTEX_INITIALIZER, slots, LOCKER_ISOLATES, 0, LOCKER_CALLS };
+        pthread_t threads[workers];
+        double start = now();
+
+        for (long i = 0; i < workers; i++)
+            pthread_create(&threads[i], NULL, (void *(*)(void *))locker_worker, &queue);
+
+        for (long i = 0; i < workers; i++)
+            pthread_join(threads[i], NULL);
+
+        printf("locker: %2ld workers, %9.0f calls/s\n", workers, LOCKER_CALLS / (now() - start));
+    }
+
+    for (size_t i = 0; i < LOCKER_ISOLATES; i++)
+        v8_isolate_dispose(slots[i].isolate);
+}
+
+
+///////////////////////////////////
+//  CONTEXT
+///////////////////////////////////
+
+
+#define CONTEXT_REQUESTS    2000
+#define CONTEXT_POOL_SIZE   16
+
+static const char *context_script = "let event = { id: 1, name: 'request' }; event.id + 1";
+
+void context_request(v8_context_t *context)
+{
+    v8_context_enter(context);
+    v8_script_run(context_script);
+    v8_context_exit(context);
+}
+
+void bench_context(void)
+{
+    v8_isolate_t *isolate;
+    double start;
+
+    // One isolate per request.
+    start = now();
+
+    for (size_t i = 0; i < CONTEXT_REQUESTS; i++) {
+        isolate = v8_isolate_new();
+
+        v8_isolate_enter(isolate);
+        context_request(v8_isolate_context(isolate));
+        v8_isolate_exit(isolate);
+
+        v8_isolate_dispose(isolate);
+    }
+
+    printf("context: isolate per request, %9.0f requests/s\n", CONTEXT_REQUESTS / (now() - start));
+
+    // One context per request.
+    isolate = v8_isolate_new();
+    v8_isolate_enter(isolate);
+    start = now();
+
+    for (size_t i = 0; i < CONTEXT_REQUESTS; i++) {
+        v8_context_t *context = v8_context_new();
+
+        context_request(context);
+        v8_context_dispose(context);
+    }
+
+    printf("context: context per request, %9.0f requests/s\n", CONTEXT_REQUESTS / (now() - start));
+
+    // Pooled contexts, refilled between bursts of requests.
+    v8_context_pool_t *pool = v8_context_pool_new(CONTEXT_POOL_SIZE);
+    double refill           = 0;
+    start                   = now();
+
+    for (size_t i = 0; i < CONTEXT_REQUESTS; i++) {
+        v8_context_t *context = v8_context_pool_acquire(pool);
+
+        context_request(context);
+        v8_context_pool_release(pool, context);
+
+        // Idle time of the host loop.
+        if ((i + 1) % CONTEXT_POOL_SIZE == 0) {
+            double idle = now();
+
+            v8_context_pool_refill(pool);
+            refill += now() - idle;
+        }
+    }
+
+    // Refilling is part of the cost, it is only moved out of the request path.
+    double total = now() - start;
+
+    printf("context: pooled contexts, %9.0f requests/s (%.0f%% of the time spent refilling)\n",
+        CONTEXT_REQUESTS / total, 100 * refill / total);
+
+    v8_context_pool_dispose(pool);
+    v8_isolate_exit(isolate);
+    v8_isolate_dispose(isolate);
+}
+
+
+///////////////////////////////////
+//  MAIN
+///////////////////////////////////
+
+
+int main(int argc, char **argv)
+{
+    v8_instance_t *instance = v8_initialize(argv[0]);
+
+    bench_locker();
+    bench_context();
+
+    v8_shutdown(instance);
+    return (0);
+}
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+export LD_LIBRARY_PATH=$(realpath ../)
+
+# Compile benchmark.
+gcc bench.c -O3 -I../include -L../ -lv8c -lpthread -o bench
+
+# Execute benchmark.
+./bench
@@ -87,26 +87,17 @@ void func_schedule(v8_callback_info_t cb_info, int argc, queue_t *data)
 ///////////////////////////////////
 
 
-void on_context_start(v8_value_t global, void *data)
+void on_context_start(v8_value_t global, queue_t *queue)
 {
-    queue_t queue   = { 0 };
     char *script    = read_file("script.js");
 
     // Set global object properties.
     v8_set_obj_var(global, "println"         , v8_create_function((v8_callback_info_t)func_println, NULL));
-    v8_set_obj_var(global, "scheduleTicks"   , v8_create_function((v8_callback_info_t)func_schedule, &queue));
+    v8_set_obj_var(global, "scheduleTicks"   , v8_create_function((v8_callback_info_t)func_schedule, queue));
 
     // Run script.
     v8_script_run(script);
 
-    // Get local value i don't know why but if the element is not referenced it is been freed by the garbage collector, OOF.
-    v8_value_t callback = v8_get_ref_value(queue.callback);
-
-    while (1) {
-        // Call callback.
-        v8_call_function(callback, NULL, 0);
-    }
-
     // Free script.
     free(script);
 }
@@ -120,10 +111,33 @@ void on_context_start(v8_value_t global, void *data)
 int main(int argc, char **argv)
 {
     v8_instance_t *instance = v8_initialize(argv[0]);
+    queue_t queue           = { 0 };
 
     // Create a V8 isolate and JS stack.
-    v8_isolate_start(on_context_start, NULL);
+    v8_isolate_t *isolate   = v8_isolate_new();
+    v8_context_t *context   = v8_isolate_context(isolate);
+
+    // Run script once.
+    v8_isolate_enter(isolate);
+    on_context_start(v8_context_enter(context), &queue);
+    v8_context_exit(context);
+    v8_isolate_exit(isolate);
+
+    while (1) {
+        v8_isolate_enter(isolate);
+        v8_context_enter(context);
+
+        // Get local value of the persistent callback and call it.
+        v8_call_function(v8_get_ref_value(queue.callback), NULL, 0);
+
+        // Run tasks posted by V8 for at most 1ms.
+        v8_isolate_pump(isolate, 1000);
+
+        v8_context_exit(context);
+        v8_isolate_exit(isolate);
+    }
 
+    v8_isolate_dispose(isolate);
     v8_shutdown(instance);
     return (0);
 }